@@ -0,0 +1,78 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Small microbenchmark harness for the RayTracerBench target. A benchmark is a function that
+// runs its kernel once over a fixed input set and returns how many items it processed; the
+// harness repeats it until min_seconds have passed and reports the best pass as items/second.
+// Benchmarks register themselves with BENCHMARK(name) and are picked by substring on the
+// command line.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+struct entry {
+    std::string name;
+    std::function<size_t()> run;
+};
+
+inline std::vector<entry>& registry() {
+    static std::vector<entry> benchmarks;
+    return benchmarks;
+}
+
+struct registrar {
+    registrar(const char* name, size_t (*run)()) { registry().push_back({name, run}); }
+};
+
+// Keeps the compiler from dropping a result nobody reads. On GCC and Clang an empty asm takes
+// the value as an input; elsewhere it goes through a volatile, read back so no compiler calls
+// the store unused.
+template <typename T>
+inline void keep(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value));
+#else
+    static volatile T sink;
+    sink = value;
+    (void)sink;
+#endif
+}
+
+inline int run_all(int argc, char** argv, double min_seconds = 0.5) {
+    std::printf("%-40s %12s %8s\n", "benchmark", "Mitems/s", "passes");
+    for (const entry& b : registry()) {
+        bool selected = argc < 2;
+        for (int k = 1; k < argc; ++k) selected |= std::strstr(b.name.c_str(), argv[k]) != nullptr;
+        if (!selected) continue;
+
+        b.run();  // warm up caches and lazily built inputs
+        double best = 0.0, total = 0.0;
+        int passes = 0;
+        while (total < min_seconds || passes < 3) {
+            auto start = std::chrono::steady_clock::now();
+            size_t items = b.run();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            total += seconds;
+            ++passes;
+            if (seconds > 0.0) best = std::max(best, items / seconds);
+        }
+        std::printf("%-40s %12.2f %8d\n", b.name.c_str(), best / 1e6, passes);
+    }
+    return 0;
+}
+
+}
+
+#define BENCHMARK(name) \
+    static size_t name(); \
+    static bench::registrar name##_registrar(#name, &name); \
+    static size_t name()
+
+#endif
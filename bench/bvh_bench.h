@@ -0,0 +1,92 @@
+#ifndef BVH_BENCH_H
+#define BVH_BENCH_H
+
+#include "bench.h"
+#include "inputs.h"
+
+#include "objects/sphere.h"
+#include "objects/packed_primitives.h"
+#include "objects/transform.h"
+#include "objects/instance.h"
+#include "utility/bvh.h"
+
+#include <vector>
+
+// Closest hit through a whole tree: 4096 rays into 10,000 small spheres filling the cube of
+// half size 1, the pointer based bvh_node and the flattened bvh_tree built from the same list,
+// and packed_primitives holding the same spheres as plain data. Then one sphere turned and moved
+// by a transform_o and by an instance, which differ in how they transform rays, and with the
+// same motion baked into the sphere itself.
+
+namespace bvh_bench {
+
+inline const hittable_list& spheres() {
+    static const hittable_list list = [] {
+        sampler rng(21);
+        hittable_list l;
+        for (int k = 0; k < 10000; ++k)
+            l.add(make_shared<sphere>(bench::random_in_cube(rng, 1.0f), rng.next_float(0.005f, 0.03f), nullptr));
+        return l;
+    }();
+    return list;
+}
+
+inline std::vector<packed_primitive> packed_spheres() {
+    sampler rng(21);
+    std::vector<packed_primitive> prims(10000);
+    for (packed_primitive& prim : prims) {
+        vec3 center = bench::random_in_cube(rng, 1.0f);
+        prim = {{center.x, center.y, center.z, rng.next_float(0.005f, 0.03f)}, packed_primitive::sphere_kind, 0};
+    }
+    return prims;
+}
+
+inline const std::vector<ray>& rays() {
+    static const std::vector<ray> set = bench::random_rays(4096, 4.0f, 1.0f, 2);
+    return set;
+}
+
+inline size_t trace(const hittable& tree) {
+    int hits = 0;
+    hit_record rec;
+    for (const ray& r : rays()) hits += tree.hit(r, interval(0.001f, infinity), rec);
+    bench::keep(hits);
+    return rays().size();
+}
+
+}
+
+BENCHMARK(bvh_node_hit) {
+    static const bvh_node tree(bvh_bench::spheres());
+    return bvh_bench::trace(tree);
+}
+
+BENCHMARK(bvh_tree_hit) {
+    static const bvh_tree tree(bvh_bench::spheres());
+    return bvh_bench::trace(tree);
+}
+
+BENCHMARK(packed_primitives_hit) {
+    static const packed_primitives packed(bvh_bench::packed_spheres(), {nullptr});
+    return bvh_bench::trace(packed);
+}
+
+BENCHMARK(transform_o_hit) {
+    static const shared_ptr<transform_o> moved = make_shared<transform_o>(make_shared<sphere>(vec3(), 0.5f, nullptr))
+                                                 ->rotate(30.0f, vec3(0.0f, 1.0f, 0.0f))->translate(vec3(0.1f, 0.0f, 0.0f));
+    return bvh_bench::trace(*moved);
+}
+
+BENCHMARK(instance_hit) {
+    static const instance moved(make_shared<sphere>(vec3(), 0.5f, nullptr),
+                                affine::translate(vec3(0.1f, 0.0f, 0.0f)) * affine::rotate(30.0f, vec3(0.0f, 1.0f, 0.0f)));
+    return bvh_bench::trace(moved);
+}
+
+BENCHMARK(baked_transform_hit) {
+    static const shared_ptr<hittable> moved = make_shared<sphere>(vec3(), 0.5f, nullptr)
+        ->transformed(affine::translate(vec3(0.1f, 0.0f, 0.0f)) * affine::rotate(30.0f, vec3(0.0f, 1.0f, 0.0f)));
+    return bvh_bench::trace(*moved);
+}
+
+#endif
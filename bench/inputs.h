@@ -0,0 +1,48 @@
+#ifndef BENCH_INPUTS_H
+#define BENCH_INPUTS_H
+
+#include "raytracer.h"
+
+#include <vector>
+
+// Fixed inputs shared by the benchmarks. They come from seeded samplers, so every run and every
+// commit measures the same rays and points.
+
+namespace bench {
+
+inline vec3 random_in_cube(sampler& rng, float half) {
+    return vec3(rng.next_float(-half, half), rng.next_float(-half, half), rng.next_float(-half, half));
+}
+
+// Rays starting on a sphere of radius distance around the origin, aimed at points in the cube
+// of half size target
+inline std::vector<ray> random_rays(int count, float distance, float target, std::uint64_t seed) {
+    sampler rng(seed);
+    std::vector<ray> rays;
+    rays.reserve(count);
+    for (int k = 0; k < count; ++k) {
+        vec3 origin = distance * random_in_cube(rng, 1.0f).dir();
+        rays.push_back(ray(origin, random_in_cube(rng, target) - origin));
+    }
+    return rays;
+}
+
+inline std::vector<vec3> random_points(int count, float half, std::uint64_t seed) {
+    sampler rng(seed);
+    std::vector<vec3> points;
+    points.reserve(count);
+    for (int k = 0; k < count; ++k) points.push_back(random_in_cube(rng, half));
+    return points;
+}
+
+inline std::vector<vec3> random_directions(int count, std::uint64_t seed) {
+    sampler rng(seed);
+    std::vector<vec3> directions;
+    directions.reserve(count);
+    for (int k = 0; k < count; ++k) directions.push_back(random_unit_vector(rng));
+    return directions;
+}
+
+}
+
+#endif
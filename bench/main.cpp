@@ -0,0 +1,16 @@
+#include "bench.h"
+
+// The renderer's headers define their functions in place, so the benchmarks are included here
+// and the whole target is one translation unit
+#include "triangle_bench.h"
+#include "primitive_bench.h"
+#include "bvh_bench.h"
+#include "texture_bench.h"
+#include "pdf_bench.h"
+#include "vec3_bench.h"
+
+// Runs every registered benchmark, or the ones whose name contains one of the arguments,
+// e.g. RayTracerBench triangle
+int main(int argc, char** argv) {
+    return bench::run_all(argc, argv);
+}
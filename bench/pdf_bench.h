@@ -0,0 +1,100 @@
+#ifndef PDF_BENCH_H
+#define PDF_BENCH_H
+
+#include "bench.h"
+#include "inputs.h"
+
+#include "math/pdf.h"
+#include "objects/hittable_list.h"
+#include "objects/sphere.h"
+#include "objects/quad.h"
+
+#include <vector>
+
+// Each pdf draws a direction with generate() and evaluates value() for it, the pair the
+// integrator runs at every bounce. The sampler is reseeded per pass so every pass draws the
+// same directions.
+
+namespace pdf_bench {
+
+const int samples = 65536;
+
+// Shading points and their normals, on the floor of a unit box
+inline const std::vector<vec3>& points() {
+    static const std::vector<vec3> set = [] {
+        sampler rng(41);
+        std::vector<vec3> p;
+        for (int k = 0; k < 1024; ++k) p.push_back(vec3(rng.next_float(-0.5f, 0.5f), -0.5f, rng.next_float(-0.5f, 0.5f)));
+        return p;
+    }();
+    return set;
+}
+
+inline const std::vector<vec3>& normals() {
+    static const std::vector<vec3> set = bench::random_directions(1024, 42);
+    return set;
+}
+
+inline size_t sample(const pdf& p, sampler& rng, int count) {
+    double sum = 0.0;
+    for (int k = 0; k < count; ++k) sum += p.value(p.generate(rng));
+    bench::keep(sum);
+    return count;
+}
+
+// Light pdfs from every shading point, samples / points().size() samples each
+inline size_t sample_light(const hittable& light) {
+    sampler rng(43);
+    size_t count = 0;
+    for (const vec3& p : points()) count += sample(hittable_pdf(light, p), rng, samples / int(points().size()));
+    return count;
+}
+
+inline const quad& quad_light() {
+    static const quad light(vec3(-0.15f, 0.5f, -0.15f), vec3(0.3f, 0, 0), vec3(0, 0, 0.3f), nullptr);
+    return light;
+}
+
+inline const sphere& sphere_light() {
+    static const sphere light(vec3(0, 0.3f, 0), 0.1f, nullptr);
+    return light;
+}
+
+}
+
+BENCHMARK(pdf_sphere) {
+    sampler rng(44);
+    return pdf_bench::sample(sphere_pdf(), rng, pdf_bench::samples);
+}
+
+// Built per shading point like the materials do, so the onb setup is part of the cost
+BENCHMARK(pdf_cosine) {
+    sampler rng(45);
+    size_t count = 0;
+    for (const vec3& n : pdf_bench::normals())
+        count += pdf_bench::sample(cosine_pdf(n), rng, pdf_bench::samples / int(pdf_bench::normals().size()));
+    return count;
+}
+
+BENCHMARK(pdf_hittable_quad) {
+    return pdf_bench::sample_light(pdf_bench::quad_light());
+}
+
+BENCHMARK(pdf_hittable_sphere) {
+    return pdf_bench::sample_light(pdf_bench::sphere_light());
+}
+
+// The integrator's usual mix of light sampling and the material's cosine lobe
+BENCHMARK(pdf_mixture) {
+    sampler rng(46);
+    size_t count = 0;
+    const std::vector<vec3>& points = pdf_bench::points();
+    for (size_t k = 0; k < points.size(); ++k) {
+        hittable_pdf light(pdf_bench::quad_light(), points[k]);
+        cosine_pdf surface(vec3(0, 1, 0));
+        count += pdf_bench::sample(mixture_pdf(light, surface, 0.5f), rng, pdf_bench::samples / int(points.size()));
+    }
+    return count;
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef PRIMITIVE_BENCH_H
+#define PRIMITIVE_BENCH_H
+
+#include "bench.h"
+#include "inputs.h"
+
+#include "math/mat4.h"
+#include "objects/hittable_list.h"
+#include "objects/sphere.h"
+#include "objects/quad.h"
+#include "objects/patch.h"
+
+#include <vector>
+
+// hit() of single primitives: 4096 rays against 256 primitives scattered through the unit cube,
+// every ray against every primitive
+
+namespace primitive_bench {
+
+const int count = 256;
+
+inline const std::vector<ray>& rays() {
+    static const std::vector<ray> set = bench::random_rays(4096, 3.0f, 0.5f, 1);
+    return set;
+}
+
+template <typename T>
+size_t hit_all(const std::vector<shared_ptr<T>>& objects) {
+    int hits = 0;
+    hit_record rec;
+    for (const ray& r : rays()) {
+        for (const auto& object : objects) hits += object->hit(r, interval(0.001f, infinity), rec);
+    }
+    bench::keep(hits);
+    return rays().size() * objects.size();
+}
+
+}
+
+BENCHMARK(sphere_hit) {
+    static const std::vector<shared_ptr<sphere>> spheres = [] {
+        sampler rng(11);
+        std::vector<shared_ptr<sphere>> s;
+        for (int k = 0; k < primitive_bench::count; ++k)
+            s.push_back(make_shared<sphere>(bench::random_in_cube(rng, 0.5f), rng.next_float(0.02f, 0.1f), nullptr));
+        return s;
+    }();
+    return primitive_bench::hit_all(spheres);
+}
+
+BENCHMARK(quad_hit) {
+    static const std::vector<shared_ptr<quad>> quads = [] {
+        sampler rng(12);
+        std::vector<shared_ptr<quad>> s;
+        for (int k = 0; k < primitive_bench::count; ++k) {
+            vec3 Q = bench::random_in_cube(rng, 0.5f);
+            s.push_back(make_shared<quad>(Q, bench::random_in_cube(rng, 0.15f), bench::random_in_cube(rng, 0.15f), nullptr));
+        }
+        return s;
+    }();
+    return primitive_bench::hit_all(quads);
+}
+
+// Bilinear patches, with corners scattered around a center so most are twisted
+BENCHMARK(patch_hit) {
+    static const std::vector<shared_ptr<patch>> patches = [] {
+        sampler rng(13);
+        std::vector<shared_ptr<patch>> s;
+        for (int k = 0; k < primitive_bench::count; ++k) {
+            vec3 center = bench::random_in_cube(rng, 0.5f);
+            s.push_back(make_shared<patch>(center + bench::random_in_cube(rng, 0.15f), center + bench::random_in_cube(rng, 0.15f),
+                                           center + bench::random_in_cube(rng, 0.15f), center + bench::random_in_cube(rng, 0.15f),
+                                           nullptr));
+        }
+        return s;
+    }();
+    return primitive_bench::hit_all(patches);
+}
+
+BENCHMARK(bbox_hit) {
+    static const std::vector<bbox> boxes = [] {
+        sampler rng(14);
+        std::vector<bbox> s;
+        for (int k = 0; k < primitive_bench::count; ++k) {
+            vec3 corner = bench::random_in_cube(rng, 0.5f);
+            s.push_back(bbox(corner, corner + vec3(rng.next_float(0.02f, 0.2f), rng.next_float(0.02f, 0.2f), rng.next_float(0.02f, 0.2f))));
+        }
+        return s;
+    }();
+
+    int hits = 0;
+    for (const ray& r : primitive_bench::rays()) {
+        for (const bbox& box : boxes) hits += box.hit(r, interval(0.001f, infinity));
+    }
+    bench::keep(hits);
+    return primitive_bench::rays().size() * boxes.size();
+}
+
+#endif
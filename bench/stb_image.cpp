@@ -0,0 +1,4 @@
+// The renderer gets stb_image's implementation through SFML; the benchmarks don't link SFML, so
+// they build it here
+#define STB_IMAGE_IMPLEMENTATION
+#include "../src/external/stb/stb_image.h"
@@ -0,0 +1,49 @@
+#ifndef TEXTURE_BENCH_H
+#define TEXTURE_BENCH_H
+
+#include "bench.h"
+#include "inputs.h"
+
+#include "objects/texture.h"
+#include "utility/cubemap.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Texture lookups at 4096 fixed points or directions
+
+BENCHMARK(perlin_turb) {
+    static const perlin noise = [] {
+        seed_random(31);
+        return perlin();
+    }();
+    static const std::vector<vec3> points = bench::random_points(4096, 4.0f, 32);
+
+    double sum = 0.0;
+    for (const vec3& p : points) sum += noise.turb(p, 7);
+    bench::keep(sum);
+    return points.size();
+}
+
+// The scene 11 cubemap, looked for from the working directory and the directories above it.
+// Without it the lookups still run, on magenta stand in pixels.
+BENCHMARK(cubemap_value) {
+    static const cubemap map = [] {
+        std::string path = "assets/cubemaps/cubemap_iceriver";
+        for (int up = 0; up < 4 && !std::ifstream(path + "/posx.png"); ++up) path = "../" + path;
+        return cubemap(path.c_str());
+    }();
+    static const std::vector<ray> rays = [] {
+        std::vector<ray> r;
+        for (const vec3& d : bench::random_directions(4096, 33)) r.push_back(ray(vec3(), d));
+        return r;
+    }();
+
+    vec3 sum;
+    for (const ray& r : rays) sum += map.value(r);
+    bench::keep(sum.x + sum.y + sum.z);
+    return rays.size();
+}
+
+#endif
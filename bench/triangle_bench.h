@@ -0,0 +1,118 @@
+#ifndef TRIANGLE_BENCH_H
+#define TRIANGLE_BENCH_H
+
+#include "bench.h"
+#include "inputs.h"
+
+#include "objects/triangle.h"
+
+#include <vector>
+
+// Ray/triangle kernels over the same 1024 triangles and 4096 rays, every ray against every
+// triangle. About a third of the tests hit.
+
+namespace triangle_bench {
+
+struct triangle_set {
+    std::vector<vec3> p0, p1, p2;
+    std::vector<vec3> u, v;     // edges from p0, as the Cramer's rule test stores them
+    std::vector<ray> rays;
+    std::vector<shared_ptr<triangle>> objects;
+};
+
+inline const triangle_set& inputs() {
+    static const triangle_set set = [] {
+        triangle_set s;
+        sampler rng(2024);
+        auto in_cube = [&](float half) { return bench::random_in_cube(rng, half); };
+
+        for (int k = 0; k < 1024; ++k) {
+            vec3 center = in_cube(0.5f);
+            s.p0.push_back(center + in_cube(0.4f));
+            s.p1.push_back(center + in_cube(0.4f));
+            s.p2.push_back(center + in_cube(0.4f));
+            s.u.push_back(s.p1.back() - s.p0.back());
+            s.v.push_back(s.p2.back() - s.p0.back());
+            s.objects.push_back(make_shared<triangle>(s.p0.back(), s.p1.back(), s.p2.back(), nullptr));
+        }
+        s.rays = bench::random_rays(4096, 3.0f, 0.5f, 1);
+        return s;
+    }();
+    return set;
+}
+
+// The Cramer's rule test triangle::hit used before the watertight kernel, for comparison
+inline float determinant(vec3 c1, vec3 c2, vec3 c3) {
+    return dot(c2, cross(c3, c1));
+}
+
+inline bool intersect_cramer(const ray& r, const vec3& Q, const vec3& u, const vec3& v,
+                      const interval& ray_t, float& t, float& a, float& b) {
+    float det = determinant(-r.dir(), u, v);
+    if (std::fabs(det) < 1e-8) return false;
+
+    vec3 OQ = r.pt() - Q;
+    a = determinant(-r.dir(), OQ, v) / det;
+    b = determinant(-r.dir(), u, OQ) / det;
+    if (a < 0 || b < 0 || a + b > 1) return false;
+
+    t = determinant(OQ, u, v) / det;
+    return ray_t.contains(t);
+}
+
+}
+
+BENCHMARK(triangle_cramer) {
+    const triangle_bench::triangle_set& s = triangle_bench::inputs();
+    int hits = 0;
+    for (const ray& r : s.rays) {
+        for (size_t k = 0; k < s.p0.size(); ++k) {
+            float t, a, b;
+            hits += triangle_bench::intersect_cramer(r, s.p0[k], s.u[k], s.v[k], interval(0.001f, infinity), t, a, b);
+        }
+    }
+    bench::keep(hits);
+    return s.rays.size() * s.p0.size();
+}
+
+// Shear read from the ray's cache on every test, the way triangle::hit runs
+BENCHMARK(triangle_watertight) {
+    const triangle_bench::triangle_set& s = triangle_bench::inputs();
+    int hits = 0;
+    for (const ray& r : s.rays) {
+        for (size_t k = 0; k < s.p0.size(); ++k) {
+            float t, a, b;
+            hits += intersect_triangle(r, s.p0[k], s.p1[k], s.p2[k], interval(0.001f, infinity), t, a, b);
+        }
+    }
+    bench::keep(hits);
+    return s.rays.size() * s.p0.size();
+}
+
+// Shear fetched once per ray, the way triangle_mesh runs
+BENCHMARK(triangle_watertight_per_ray) {
+    const triangle_bench::triangle_set& s = triangle_bench::inputs();
+    int hits = 0;
+    for (const ray& r : s.rays) {
+        const ray_shear& shear = r.shear();
+        for (size_t k = 0; k < s.p0.size(); ++k) {
+            float t, a, b;
+            hits += intersect_triangle(r.pt(), shear, s.p0[k], s.p1[k], s.p2[k], interval(0.001f, infinity), t, a, b);
+        }
+    }
+    bench::keep(hits);
+    return s.rays.size() * s.p0.size();
+}
+
+BENCHMARK(triangle_hit) {
+    const triangle_bench::triangle_set& s = triangle_bench::inputs();
+    int hits = 0;
+    hit_record rec;
+    for (const ray& r : s.rays) {
+        for (const auto& object : s.objects) hits += object->hit(r, interval(0.001f, infinity), rec);
+    }
+    bench::keep(hits);
+    return s.rays.size() * s.objects.size();
+}
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef VEC3_BENCH_H
+#define VEC3_BENCH_H
+
+#include "bench.h"
+#include "inputs.h"
+
+#include "math/onb.h"
+
+#include <vector>
+
+// vec3 math over 4096 fixed vectors. Build once more with RAYTRACER_NO_SIMD defined to compare
+// the SSE/NEON vec3 with the scalar one.
+
+namespace vec3_bench {
+
+inline const std::vector<vec3>& a() {
+    static const std::vector<vec3> set = bench::random_points(4096, 1.0f, 51);
+    return set;
+}
+
+inline const std::vector<vec3>& b() {
+    static const std::vector<vec3> set = bench::random_points(4096, 1.0f, 52);
+    return set;
+}
+
+}
+
+BENCHMARK(vec3_add_scale) {
+    vec3 sum;
+    for (size_t k = 0; k < vec3_bench::a().size(); ++k) sum += 0.5f * (vec3_bench::a()[k] - vec3_bench::b()[k]);
+    bench::keep(sum.x + sum.y + sum.z);
+    return vec3_bench::a().size();
+}
+
+BENCHMARK(vec3_dot) {
+    float sum = 0.0f;
+    for (size_t k = 0; k < vec3_bench::a().size(); ++k) sum += dot(vec3_bench::a()[k], vec3_bench::b()[k]);
+    bench::keep(sum);
+    return vec3_bench::a().size();
+}
+
+BENCHMARK(vec3_cross) {
+    vec3 sum;
+    for (size_t k = 0; k < vec3_bench::a().size(); ++k) sum += cross(vec3_bench::a()[k], vec3_bench::b()[k]);
+    bench::keep(sum.x + sum.y + sum.z);
+    return vec3_bench::a().size();
+}
+
+BENCHMARK(vec3_normalize) {
+    vec3 sum;
+    for (const vec3& v : vec3_bench::a()) sum += v.dir();
+    bench::keep(sum.x + sum.y + sum.z);
+    return vec3_bench::a().size();
+}
+
+// Frame setup and a transform, as cosine_pdf does per bounce
+BENCHMARK(onb_transform) {
+    vec3 sum;
+    for (size_t k = 0; k < vec3_bench::a().size(); ++k) sum += onb(vec3_bench::a()[k]).transform(vec3_bench::b()[k]);
+    bench::keep(sum.x + sum.y + sum.z);
+    return vec3_bench::a().size();
+}
+
+BENCHMARK(ray_at) {
+    vec3 sum;
+    for (size_t k = 0; k < vec3_bench::a().size(); ++k) sum += ray(vec3_bench::a()[k], vec3_bench::b()[k]).at(0.75f);
+    bench::keep(sum.x + sum.y + sum.z);
+    return vec3_bench::a().size();
+}
+
+#endif
@@ -5,8 +5,15 @@
 #include "objects/material.h"
 #include "math/pdf.h"
 #include "utility/cubemap.h"
+#include "utility/thread_pool.h"
 
-#include <thread>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <numeric>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
 
 using namespace std;
 
@@ -14,12 +21,21 @@ struct config {
     // Screen config
     float aspect_ratio = 16.0f / 9.0f;    // Ratio of image width over height
     int image_width = 1024;               // Rendered image width in pixel count
-    int tw = -1;
-    int th =  -1;
+    int tw = 32;                          // Width of the tiles handed to render threads
+    int th = 32;                          // Height of the tiles handed to render threads
 
     // Render config
     int aa_samples = 20;                   // Count of random samples for each pixel for antialiasing
     int max_depth = 16;                    // Maximum number of ray bounce recursions
+    int rr_depth = 4;                      // Bounces before paths may be ended by Russian roulette
+    uint64_t seed = 0;                     // Seed of the per pixel sample streams
+    bool progressive = false;              // Render one sample per pixel per pass, refreshing the image each pass
+    float time_limit = 0.0f;               // Seconds after which a progressive render stops, 0 for no limit
+    float adaptive_error = 0.0f;           // Relative error at which a block of pixels stops sampling, 0 to always take aa_samples
+    bool packets = false;                  // Trace camera rays through the world in packets of 8
+    bool wavefront = false;                // Trace batches of paths stage by stage instead of one path at a time
+    int min_samples = 16;                  // Samples every pixel takes before adaptive sampling may stop its block
+    bool cost_map = false;                 // Measure the time, BVH node visits and primitive tests of every pixel
     
     // Camera config
     float vfov = 90.0f;                    // Vertical view angle (field of view)
@@ -32,7 +48,7 @@ struct config {
     float focus_dist = 0.0f;               // Distance from camera lens to plane of perfect focus
 
     vec3 background;
-    const char* cmap = "";
+    std::string cmap;                      // Cubemap directory, none if empty
 };
 
 class camera {
@@ -43,13 +59,25 @@ class camera {
         vec3 pixel_delta_v;         // Vertical offset of pixel
         vec3 defocus_disk_u;        // Horizontal disk radius
         vec3 defocus_disk_v;        // Vertial disk radius
-        int tw, th;                 // Width/Height of portion of image rendered by threads
+        int tw, th;                 // Width/Height of the tiles rendered by the thread pool
         cubemap cmap;               // Cubemap
+        vector<vec3> accumulation;  // Running sum of the samples of each pixel
+        vector<float> lum_sum;      // Running sums of sample luminance and its square, for the variance
+        vector<float> lum_sq;       // estimates of adaptive sampling
+        vector<int> sample_count;   // Samples taken by each pixel
+        vector<float> pixel_seconds;    // Cost of each pixel's samples when cost_map is set, node visits
+        vector<float> pixel_nodes;      // and primitive tests are only counted in builds with
+        vector<float> pixel_tests;      // RAYTRACER_STATS
+        atomic<bool> stop_requested{false};
+        atomic<uint64_t> rays_traced{0};    // rays intersected with the world in the last render
+
+        // Rays traced by this thread, render tasks add what they traced to rays_traced
+        static inline thread_local uint64_t thread_rays = 0;
         
         void initialize() {
             image_height = max(int(image_width / aspect_ratio), 1);
-            if (tw == -1) tw = image_width;
-            if (th == -1) th = image_height;
+            if (tw <= 0) tw = image_width;
+            if (th <= 0) th = image_height;
             
             vec3 forward, right, up;    // Camera frame basis vectors
             forward = (target - pos).dir();
@@ -77,72 +105,549 @@ class camera {
             defocus_disk_v = defocus_radius * up;
         }
 
-        vec3 defocus_disk_sample() const {
-            vec3 p = random_in_unit_disk();
+        vec3 defocus_disk_sample(sampler& rng) const {
+            vec3 p = random_in_unit_disk(rng);
             return pos + p.x * defocus_disk_u + p.y * defocus_disk_v;
         }
 
-        ray get_ray(int i, int j) const{
-            vec3 offset = vec3(random_float() - 0.5f, random_float() - 0.5f, 0.0f);
+        ray get_ray(int i, int j, sampler& rng) const{
+            vec3 offset = vec3(rng.next_float() - 0.5f, rng.next_float() - 0.5f, 0.0f);
             vec3 pixel_sample = pixel_center00 + 
                                 ((i + offset.x) * pixel_delta_u) + 
                                 ((j + offset.y) * pixel_delta_v);
 
-            vec3 ray_pos = (defocus_angle <= 0.0f) ? pos : defocus_disk_sample();
+            vec3 ray_pos = (defocus_angle <= 0.0f) ? pos : defocus_disk_sample(rng);
 
             vec3 ray_dir = pixel_sample - ray_pos;
 
-            float ray_time = random_float();
+            float ray_time = rng.next_float();
 
             return ray(ray_pos, ray_dir, ray_time);
         }
 
-        vec3 ray_color(const ray& r, int depth, const hittable& world, const hittable& lights) const {
-            if (!depth) return vec3();
-
+        vec3 ray_color(const ray& r, int depth, const hittable& world, const hittable& lights, sampler& rng) const {
             hit_record rec;
+            bool hit = depth > 0 && world.hit(r, interval(0.001f, infinity), rec);
+            thread_rays += depth > 0;
+            if (depth > 0) RT_STAT(primary_rays);
+            return path_color(r, hit, rec, depth, world, lights, rng);
+        }
 
-            if (!world.hit(r, interval(0.001f, infinity), rec)) {
-                if (cmap) return cmap.value(r);
-                return background;
-            }
+        vec3 background_color(const ray& r) const {
+            return cmap ? cmap.value(r) : background;
+        }
 
+        // One bounce of a path at its intersection rec: adds the emission that reaches the camera
+        // to radiance, then scatters r and updates throughput. Returns false when the path ends.
+        bool shade(ray& r, const hit_record& rec, int bounce, vec3& radiance, vec3& throughput,
+                   const hittable& lights, sampler& rng) const {
             scatter_record srec;
             vec3 emission = rec.mat->emitted(r, rec, rec.u, rec.v, rec.pt);
 
-            if (!rec.mat->scatter(r, rec, srec))
-                return emission;
-            
+            if (!rec.mat->scatter(r, rec, srec, rng)) {
+                radiance += throughput * emission;
+                return false;
+            }
+
             if (srec.skip_pdf) {
-                return srec.attenuation * ray_color(srec.skip_pdf_ray, depth - 1, world, lights);
+                throughput = throughput * srec.attenuation;
+                r = srec.skip_pdf_ray;
+            } else {
+                float w = lights.empty() ? 0.0f : 0.5f;
+                // Mixing in the light pdf, whose value tests the lights but traces no shadow ray
+                if (!lights.empty()) RT_STAT(light_samples);
+                hittable_pdf light_pdf(lights, rec.pt);
+                mixture_pdf mixed_pdf(light_pdf, *srec.pdf_ptr(), w);
+                ray scattered = ray(rec.pt, mixed_pdf.generate(rng), r.time());
+                float pdf_value = mixed_pdf.value(scattered.dir());
+
+                float scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+
+                radiance += throughput * emission;
+                throughput = throughput * srec.attenuation * (scattering_pdf / pdf_value);
+                r = scattered;
+            }
+
+            // Russian roulette: past rr_depth bounces, continue with probability equal to
+            // the path's throughput and scale survivors up so the estimate stays unbiased
+            if (bounce + 1 >= rr_depth) {
+                float survive = std::min(std::max({throughput.x, throughput.y, throughput.z}), 0.95f);
+                if (rng.next_float() >= survive) return false;
+                throughput /= survive;
+            }
+            return true;
+        }
+
+        // Follows a path whose first intersection (hit, rec) is already known
+        vec3 path_color(const ray& r_in, bool hit, hit_record rec, int depth, const hittable& world, const hittable& lights, sampler& rng) const {
+            // Iterative path tracer: throughput is the product of attenuation * pdf weights
+            // along the path so far, radiance collects what reaches the camera through it
+            vec3 radiance;
+            vec3 throughput(1.0f);
+            ray r = r_in;
+            int length = depth > 0;     // rays traced along the path, for the stats
+
+            for (int bounce = 0; bounce < depth; ++bounce) {
+                if (!hit) {
+                    radiance += throughput * background_color(r);
+                    break;
+                }
+
+                if (!shade(r, rec, bounce, radiance, throughput, lights, rng)) break;
+
+                if (bounce + 1 < depth) {
+                    hit = world.hit(r, interval(0.001f, infinity), rec);
+                    ++thread_rays;
+                    RT_STAT(secondary_rays);
+                    ++length;
+                }
+            }
+
+            RT_STAT_PATH(length);
+            return radiance;
+        }
+
+        // Adaptive sampling decides per block of pixels: one pixel's few samples say little about
+        // its variance when most paths miss the light, but a block's pooled samples do
+        static const int adaptive_block = 8;
+
+        // True once the RMS standard error of the block's pixel means is within adaptive_error of
+        // the block's mean luminance. Dark blocks are measured against a floor of 0.01 so they do
+        // not sample forever chasing a relative error of zero.
+        bool block_converged(int i, int j, int i_end, int j_end) const {
+            if (adaptive_error <= 0.0f) return false;
+
+            float mean_sum = 0.0f, error_sum = 0.0f;
+            for (int _j = j; _j < j_end; ++_j) {
+                for (int _i = i; _i < i_end; ++_i) {
+                    int index = _i + _j * image_width;
+                    int n = sample_count[index];
+                    if (n < min_samples) return false;
+
+                    float mean = lum_sum[index] / n;
+                    float variance = max(lum_sq[index] / n - mean * mean, 0.0f);
+                    mean_sum += mean;
+                    error_sum += variance / n;
+                }
+            }
+
+            float pixels = float((i_end - i) * (j_end - j));
+            return sqrt(error_sum / pixels) <= adaptive_error * max(mean_sum / pixels, 0.01f);
+        }
+
+        void add_sample(int index, const vec3& sample) {
+            accumulation[index] += sample;
+
+            float l = luminance(sample);
+            lum_sum[index] += l;
+            lum_sq[index] += l * l;
+        }
+
+        // A reading of this thread's clock and counters, the cost of some samples is the
+        // difference between the readings taken before and after them
+        struct cost_reading {
+            chrono::steady_clock::time_point time;
+            uint64_t nodes = 0;
+            uint64_t tests = 0;
+        };
+
+        cost_reading read_cost() const {
+            cost_reading c;
+            if (!cost_map) return c;
+            c.time = chrono::steady_clock::now();
+#ifdef RAYTRACER_STATS
+            c.nodes = render_stats::thread_count(render_stats::bvh_nodes, render_stats::bvh_nodes);
+            c.tests = render_stats::thread_count(render_stats::sphere_tests, render_stats::medium_tests);
+#endif
+            return c;
+        }
+
+        // Charges what was done since before evenly to the pixels of the block
+        void add_cost(const cost_reading& before, int i, int j, int i_end, int j_end) {
+            if (!cost_map) return;
+            cost_reading after = read_cost();
+            float share = 1.0f / float((i_end - i) * (j_end - j));
+            float seconds = chrono::duration<float>(after.time - before.time).count() * share;
+            for (int _j = j; _j < j_end; ++_j) {
+                for (int _i = i; _i < i_end; ++_i) {
+                    int index = _i + _j * image_width;
+                    pixel_seconds[index] += seconds;
+                    pixel_nodes[index] += float(after.nodes - before.nodes) * share;
+                    pixel_tests[index] += float(after.tests - before.tests) * share;
+                }
             }
-            
-            float w = lights.empty() ? 0.0f : 0.5f;
-            mixture_pdf mixed_pdf(make_shared<hittable_pdf>(lights, rec.pt), srec.pdf_ptr, w);
-            ray scattered = ray(rec.pt, mixed_pdf.generate(), r.time());
-            float pdf_value = mixed_pdf.value(scattered.dir());
-            
-            float scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered);
-            
-            vec3 scatter_color = (srec.attenuation * scattering_pdf * ray_color(scattered, depth - 1, world, lights)) / pdf_value;
-            
-            return emission + scatter_color;
         }
 
+        // Adds count samples to every pixel of the block and rewrites their displayed colors
+        void sample_block(const hittable* world, const hittable* lights, vector<uint8_t>* pixels,
+                          int i, int j, int i_end, int j_end, int count) {
+            if (packets) {
+                // Packets mix the samples of the whole block, so the block shares its cost
+                cost_reading before = read_cost();
+                sample_block_packets(world, lights, pixels, i, j, i_end, j_end, count);
+                add_cost(before, i, j, i_end, j_end);
+                return;
+            }
+
+            for (int _j = j; _j < j_end; ++_j){
+                for (int _i = i; _i < i_end; ++_i){
+                    int index = _i + _j * image_width;
+                    cost_reading before = read_cost();
+                    int n = sample_count[index];
+                    int n_end = n + count;
+                    for (; n < n_end; ++n) {
+                        sampler rng(seed, index, n);
+                        ray r = get_ray(_i, _j, rng);
+                        add_sample(index, ray_color(r, max_depth, *world, *lights, rng));
+                    }
+
+                    sample_count[index] = n;
+                    write_color(*pixels, accumulation[index] / float(n), index * 4);
+                    add_cost(before, _i, _j, _i + 1, _j + 1);
+                }
+            }
+        }
+
+        // Same samples as sample_block, but the camera rays are traced through the world 8 at a
+        // time. Consecutive samples of a pixel (or neighbouring pixels when taking one sample
+        // each) share a packet, so the lanes stay coherent. Bounces are traced as single rays.
+        void sample_block_packets(const hittable* world, const hittable* lights, vector<uint8_t>* pixels,
+                                  int i, int j, int i_end, int j_end, int count) {
+            ray_packet p{};
+            p.tmin = 0.001f;
+            sampler rngs[ray_packet::size];
+            int owner[ray_packet::size];    // pixel each lane samples
+            int lanes = 0;
+
+            auto flush = [&] {
+                const hittable* hit[ray_packet::size];
+                for (int k = 0; k < lanes; ++k) p.tmax[k] = infinity;
+                int hits = max_depth > 0 ? world->hit_packet(p, (1 << lanes) - 1, hit) : 0;
+                if (max_depth > 0) thread_rays += lanes;
+                if (max_depth > 0) RT_STAT_ADD(primary_rays, lanes);
+
+                for (int k = 0; k < lanes; ++k) {
+                    ray r = p.lane(k);
+                    hit_record rec;
+                    bool found = false;
+                    if (hits & (1 << k)) {
+                        // Get the full record from the primitive the packet hit, and trace the
+                        // ray on its own if that primitive disagrees at its very edge
+                        found = hit[k]->hit(r, interval(p.tmin, p.tmax[k] * 1.0001f), rec) ||
+                                world->hit(r, interval(p.tmin, infinity), rec);
+                    }
+                    add_sample(owner[k], path_color(r, found, rec, max_depth, *world, *lights, rngs[k]));
+                }
+                lanes = 0;
+            };
+
+            for (int _j = j; _j < j_end; ++_j){
+                for (int _i = i; _i < i_end; ++_i){
+                    int index = _i + _j * image_width;
+                    int n_end = sample_count[index] + count;
+                    for (int n = sample_count[index]; n < n_end; ++n) {
+                        rngs[lanes] = sampler(seed, index, n);
+                        p.set(lanes, get_ray(_i, _j, rngs[lanes]));
+                        owner[lanes] = index;
+                        if (++lanes == ray_packet::size) flush();
+                    }
+                    sample_count[index] = n_end;
+                }
+            }
+            if (lanes) flush();
+
+            for (int _j = j; _j < j_end; ++_j){
+                for (int _i = i; _i < i_end; ++_i){
+                    int index = _i + _j * image_width;
+                    write_color(*pixels, accumulation[index] / float(sample_count[index]), index * 4);
+                }
+            }
+        }
+
+        // Samples the tile block by block, adaptive blocks in rounds of 8 until they converge or
+        // reach aa_samples
         void pixel_color(const hittable* world, const hittable* lights, vector<uint8_t>* pixels, int i, int j) {
-            for (int _j = j; _j < j + th; ++_j){
-                for (int _i = i; _i < i + tw; ++_i){
-                    vec3 pixel_color;
-                    for (int sample = 0; sample < aa_samples; ++sample) {
-                        ray r = get_ray(_i, _j);
-                        pixel_color += ray_color(r, max_depth, *world, *lights) / aa_samples;
+            int j_end = min(j + th, image_height);
+            int i_end = min(i + tw, image_width);
+            int step = adaptive_error > 0.0f ? adaptive_block : max(tw, th);
+            int round = adaptive_error > 0.0f ? 8 : aa_samples;
+            for (int bj = j; bj < j_end; bj += step) {
+                for (int bi = i; bi < i_end; bi += step) {
+                    int bi_end = min(bi + step, i_end);
+                    int bj_end = min(bj + step, j_end);
+                    int n;
+                    while ((n = sample_count[bi + bj * image_width]) < aa_samples &&
+                           !block_converged(bi, bj, bi_end, bj_end))
+                        sample_block(world, lights, pixels, bi, bj, bi_end, bj_end, min(round, aa_samples - n));
+                }
+            }
+        }
+
+        // Adaptive blocks that converge early leave part of the width x height x aa_samples budget
+        // unspent. Hands it to the blocks that haven't converged, in rounds of up to 8 more
+        // samples per pixel past aa_samples, until the budget is used or every block converged.
+        void spend_saved_samples(const hittable& world, const hittable& lights, vector<uint8_t>& pixels) {
+            thread_pool& pool = thread_pool::global();
+            int64_t budget = int64_t(image_width) * image_height * aa_samples;
+            int rounds = 0;
+
+            struct block { int i, j, i_end, j_end; };
+            vector<block> open;
+            while (!stop_requested) {
+                int64_t spent = accumulate(sample_count.begin(), sample_count.end(), int64_t(0));
+                int64_t open_pixels = 0;
+                open.clear();
+                // Same block grid as pixel_color, which starts one at every tile corner
+                for (int j = 0; j < image_height; j += th) {
+                    for (int i = 0; i < image_width; i += tw) {
+                        int j_end = min(j + th, image_height);
+                        int i_end = min(i + tw, image_width);
+                        for (int bj = j; bj < j_end; bj += adaptive_block) {
+                            for (int bi = i; bi < i_end; bi += adaptive_block) {
+                                block b = {bi, bj, min(bi + adaptive_block, i_end), min(bj + adaptive_block, j_end)};
+                                if (block_converged(b.i, b.j, b.i_end, b.j_end)) continue;
+                                open.push_back(b);
+                                open_pixels += (b.i_end - b.i) * (b.j_end - b.j);
+                            }
+                        }
                     }
+                }
+                if (open.empty()) break;
+                int count = int(min<int64_t>(8, (budget - spent) / open_pixels));
+                if (count <= 0) break;
+
+                task_group blocks;
+                for (const block& b : open) {
+                    pool.submit(blocks, [this, &world, &lights, &pixels, b, count] {
+                        uint64_t rays_before = thread_rays;
+                        if (!stop_requested) sample_block(&world, &lights, &pixels, b.i, b.j, b.i_end, b.j_end, count);
+                        rays_traced += thread_rays - rays_before;
+                    });
+                }
+                pool.wait(blocks);
+                ++rounds;
+                clog << "\rSaved samples spent on " << open.size() << " unconverged blocks, round " << rounds << "   " << flush;
+            }
+            if (rounds) clog << '\n';
+        }
 
-                    write_color(*pixels, pixel_color, (_i + _j * image_width) * 4);
-                }    
+        // Adds one more sample to every pixel of the tile whose block has not converged
+        void accumulate_tile(const hittable* world, const hittable* lights, vector<uint8_t>* pixels, int i, int j) {
+            int j_end = min(j + th, image_height);
+            int i_end = min(i + tw, image_width);
+            for (int bj = j; bj < j_end; bj += adaptive_block) {
+                for (int bi = i; bi < i_end; bi += adaptive_block) {
+                    int bi_end = min(bi + adaptive_block, i_end);
+                    int bj_end = min(bj + adaptive_block, j_end);
+                    if (!block_converged(bi, bj, bi_end, bj_end))
+                        sample_block(world, lights, pixels, bi, bj, bi_end, bj_end, 1);
+                }
             }
         }
 
+        // State of the paths in flight in the wavefront renderer, one entry per path of the wave
+        struct wavefront_paths {
+            vector<int> pixel;
+            vector<ray> rays;
+            vector<vec3> throughput;
+            vector<vec3> radiance;
+            vector<sampler> rngs;
+            vector<hit_record> recs;
+            vector<uint8_t> hit;        // intersect stage found a hit
+            vector<uint8_t> alive;      // shade stage scattered the path on
+
+            void resize(int n) {
+                pixel.resize(n);
+                rays.resize(n);
+                throughput.resize(n);
+                radiance.resize(n);
+                rngs.resize(n);
+                recs.resize(n);
+                hit.resize(n);
+                alive.resize(n);
+            }
+        };
+
+        static const int wave_size = 1 << 16;
+
+        // Renders waves of wave_size paths, each stage one loop over every path of the wave:
+        // generate camera rays, intersect them, sort the hits by material type, shade them
+        // (emission, scatter, Russian roulette) and extend the survivors, until the wave is done.
+        // Sorting keeps each stretch of the shading loop on one material type's code. Finished waves are
+        // accumulated in sample order, so the image matches the tiled renderer.
+        void render_wavefront(const hittable& world, const hittable& lights, vector<uint8_t>& pixels) {
+            thread_pool& pool = thread_pool::global();
+            auto for_each_path = [&pool](int count, auto f) {
+                const int chunk = 1024;
+                pool.parallel_for((count + chunk - 1) / chunk, [&](int c) {
+                    int end = min(count, (c + 1) * chunk);
+                    for (int p = c * chunk; p < end; ++p) f(p);
+                });
+            };
+
+            enum stage { generate, intersect, sort, shade_hits, extend, accumulate, stages };
+            static const char* stage_names[stages] = {"generate", "intersect", "sort", "shade", "extend", "accumulate"};
+            double stage_time[stages] = {};
+            auto timed = [&stage_time](stage s, auto f) {
+                auto start = chrono::steady_clock::now();
+                f();
+                stage_time[s] += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            };
+
+            wavefront_paths paths;
+            paths.resize(wave_size);
+            vector<int> active;     // paths still bouncing, in wave order
+            vector<int> order;      // the active paths grouped by the type of material they hit
+            unordered_map<type_index, int> type_bins;
+            unordered_map<const material*, int> bins = {{nullptr, 0}};  // each material's type bin
+            vector<int> bin_start = {0};
+            vector<int> bin_of;
+
+            int64_t total = int64_t(image_width) * image_height * aa_samples;
+            clog << "Rendering " << total << " paths in waves of " << wave_size << " on " << pool.size() << " threads\n";
+
+            for (int64_t start = 0; start < total && !stop_requested; start += wave_size) {
+                int count = int(min<int64_t>(wave_size, total - start));
+
+                timed(generate, [&] {
+                    for_each_path(count, [&](int p) {
+                        int index = int((start + p) / aa_samples);
+                        int sample = int((start + p) % aa_samples);
+                        paths.pixel[p] = index;
+                        paths.rngs[p] = sampler(seed, index, sample);
+                        paths.rays[p] = get_ray(index % image_width, index / image_width, paths.rngs[p]);
+                        paths.throughput[p] = vec3(1.0f);
+                        paths.radiance[p] = vec3();
+                    });
+                    active.resize(count);
+                    iota(active.begin(), active.end(), 0);
+                });
+
+                for (int bounce = 0; bounce < max_depth && !active.empty(); ++bounce) {
+                    rays_traced += active.size();
+                    if (bounce == 0) RT_STAT_ADD(primary_rays, active.size());
+                    else RT_STAT_ADD(secondary_rays, active.size());
+                    timed(intersect, [&] {
+                        for_each_path(int(active.size()), [&](int a) {
+                            int p = active[a];
+                            paths.hit[p] = world.hit(paths.rays[p], interval(0.001f, infinity), paths.recs[p]);
+                        });
+                    });
+
+                    // Counting sort into one bin per material type, misses in bin 0. Stable, so
+                    // each bin keeps the wave order its rays were generated in. A material's bin
+                    // is looked up by pointer, so typeid only runs the first time one is seen.
+                    timed(sort, [&] {
+                        bin_of.resize(active.size());
+                        bin_start.assign(bin_start.size(), 0);
+                        for (size_t a = 0; a < active.size(); ++a) {
+                            int p = active[a];
+                            const material* mat = paths.hit[p] ? paths.recs[p].mat : nullptr;
+                            auto found = bins.find(mat);
+                            if (found == bins.end()) {
+                                auto type = type_bins.try_emplace(type_index(typeid(*mat)), int(bin_start.size()));
+                                if (type.second) bin_start.push_back(0);
+                                found = bins.emplace(mat, type.first->second).first;
+                            }
+                            bin_of[a] = found->second;
+                            ++bin_start[bin_of[a]];
+                        }
+                        int offset = 0;
+                        for (int& start : bin_start) {
+                            int size = start;
+                            start = offset;
+                            offset += size;
+                        }
+                        order.resize(active.size());
+                        for (size_t a = 0; a < active.size(); ++a)
+                            order[bin_start[bin_of[a]]++] = active[a];
+                    });
+
+                    timed(shade_hits, [&] {
+                        for_each_path(int(order.size()), [&](int a) {
+                            int p = order[a];
+                            if (!paths.hit[p]) {
+                                paths.radiance[p] += paths.throughput[p] * background_color(paths.rays[p]);
+                                paths.alive[p] = false;
+                                return;
+                            }
+                            paths.alive[p] = shade(paths.rays[p], paths.recs[p], bounce, paths.radiance[p],
+                                                   paths.throughput[p], lights, paths.rngs[p]);
+                        });
+                    });
+
+                    timed(extend, [&] {
+#ifdef RAYTRACER_STATS
+                        for (int p : active) if (!paths.alive[p]) RT_STAT_PATH(bounce + 1);
+#endif
+                        active.erase(remove_if(active.begin(), active.end(), [&paths](int p) { return !paths.alive[p]; }),
+                                     active.end());
+                    });
+                }
+#ifdef RAYTRACER_STATS
+                for (size_t a = 0; a < active.size(); ++a) RT_STAT_PATH(max_depth);
+#endif
+
+                timed(accumulate, [&] {
+                    for (int p = 0; p < count; ++p) {
+                        add_sample(paths.pixel[p], paths.radiance[p]);
+                        ++sample_count[paths.pixel[p]];
+                    }
+                    for (int index = paths.pixel[0]; index <= paths.pixel[count - 1]; ++index)
+                        write_color(pixels, accumulation[index] / float(sample_count[index]), index * 4);
+                });
+
+                clog << "\rPaths remaining: " << max<int64_t>(total - start - count, 0) << "        " << flush;
+            }
+
+            clog << "\rDone.                          \n";
+            clog << "Wavefront stage times:";
+            for (int s = 0; s < stages; ++s)
+                clog << (s ? ", " : " ") << stage_names[s] << ' ' << stage_time[s] << " s";
+            clog << '\n';
+        }
+
+        void render_progressive(const hittable& world, const hittable& lights, vector<uint8_t>& pixels) {
+            thread_pool& pool = thread_pool::global();
+
+            clog << "Rendering up to " << aa_samples << " passes on " << pool.size() << " threads";
+            if (time_limit > 0.0f) clog << " for at most " << time_limit << " s";
+            clog << '\n';
+
+            auto start = chrono::steady_clock::now();
+            int passes = 0;
+            int64_t budget = int64_t(image_width) * image_height * aa_samples;
+            int64_t spent = 0, last_pass = 0;
+            while (!stop_requested) {
+                // Adaptive blocks that converged saved samples, keep passing over the rest past
+                // aa_samples while another pass like the last one fits the budget
+                bool saved = adaptive_error > 0.0f && last_pass > 0 && spent + last_pass <= budget;
+                if (passes >= aa_samples && !saved) break;
+
+                task_group tiles;
+                for (int j = 0; j < image_height; j+=th) {
+                    for (int i = 0; i < image_width; i+=tw) {
+                        pool.submit(tiles, [this, &world, &lights, &pixels, i, j] {
+                            uint64_t rays_before = thread_rays;
+                            if (!stop_requested) accumulate_tile(&world, &lights, &pixels, i, j);
+                            rays_traced += thread_rays - rays_before;
+                        });
+                    }
+                }
+                pool.wait(tiles);
+                ++passes;
+                int64_t now_spent = accumulate(sample_count.begin(), sample_count.end(), int64_t(0));
+                last_pass = now_spent - spent;
+                spent = now_spent;
+
+                chrono::duration<float> elapsed = chrono::steady_clock::now() - start;
+                clog << "\rPasses done: " << passes << " (" << elapsed.count() << " s) " << flush;
+                if (time_limit > 0.0f && elapsed.count() >= time_limit) break;
+            }
+
+            clog << "\rDone after " << passes << " passes.      \n";
+        }
+
     public:
         // Screen config
         float aspect_ratio;                // Ratio of image width over height
@@ -151,6 +656,15 @@ class camera {
         // Render config
         int aa_samples;                     // Count of random samples for each pixel for antialiasing
         int max_depth;                      // Maximum number of ray bounce recursions
+        int rr_depth;                       // Bounces before paths may be ended by Russian roulette
+        uint64_t seed;                      // Seed of the per pixel sample streams
+        bool progressive;                   // Render one sample per pixel per pass, refreshing the image each pass
+        float time_limit;                   // Seconds after which a progressive render stops, 0 for no limit
+        float adaptive_error;               // Relative error at which a block of pixels stops sampling, 0 to always take aa_samples
+        bool packets;                       // Trace camera rays through the world in packets of 8
+        bool wavefront;                     // Trace batches of paths stage by stage instead of one path at a time
+        int min_samples;                    // Samples every pixel takes before adaptive sampling may stop its block
+        bool cost_map;                      // Measure the time, BVH node visits and primitive tests of every pixel
         
         // Camera config
         float vfov;                        // Vertical view angle (field of view)
@@ -171,6 +685,15 @@ class camera {
             th(cf.th),
             aa_samples(cf.aa_samples),
             max_depth(cf.max_depth),
+            rr_depth(cf.rr_depth),
+            seed(cf.seed),
+            progressive(cf.progressive),
+            time_limit(cf.time_limit),
+            adaptive_error(cf.adaptive_error),
+            packets(cf.packets),
+            wavefront(cf.wavefront),
+            min_samples(cf.min_samples),
+            cost_map(cf.cost_map),
             vfov(cf.vfov),
             pos(cf.pos),
             target(cf.target),
@@ -178,28 +701,80 @@ class camera {
             defocus_angle(cf.defocus_angle),
             focus_dist(cf.focus_dist),
             background(cf.background),
-            cmap(cf.cmap)
+            cmap(cf.cmap.c_str())
         {initialize();}
 
-        void render(const hittable& world, const hittable& lights, vector<uint8_t>& pixels, vector<thread>& threads) {
+        void render(const hittable& world, const hittable& lights, vector<uint8_t>& pixels) {
+            stop_requested = false;
+            rays_traced = 0;
+            accumulation.assign(size_t(image_width) * image_height, vec3());
+            lum_sum.assign(size_t(image_width) * image_height, 0.0f);
+            lum_sq.assign(size_t(image_width) * image_height, 0.0f);
+            sample_count.assign(size_t(image_width) * image_height, 0);
+            pixel_seconds.assign(cost_map ? size_t(image_width) * image_height : 0, 0.0f);
+            pixel_nodes.assign(pixel_seconds.size(), 0.0f);
+            pixel_tests.assign(pixel_seconds.size(), 0.0f);
+            if (wavefront) {
+                render_wavefront(world, lights, pixels);
+                return;
+            }
+            if (progressive) {
+                render_progressive(world, lights, pixels);
+                return;
+            }
+
+            thread_pool& pool = thread_pool::global();
+            task_group tiles;
+
+            int tiles_x = (image_width + tw - 1) / tw;
+            int tiles_y = (image_height + th - 1) / th;
+            atomic<int> remaining(tiles_x * tiles_y);
+            mutex log_m;
+
+            clog << "Rendering " << remaining << " tiles on " << pool.size() << " threads\n";
             for (int j = 0; j < image_height; j+=th) {
-                clog << "\rScanlines remaining: " << (image_height - j) << ' ' << flush;
                 for (int i = 0; i < image_width; i+=tw) {
-                    threads.emplace_back(&camera::pixel_color, this, &world, &lights, &pixels, i, j);
-                    // threads[threads.size() - 1].detach();
+                    pool.submit(tiles, [this, &world, &lights, &pixels, &remaining, &log_m, i, j] {
+                        uint64_t rays_before = thread_rays;
+                        if (!stop_requested) pixel_color(&world, &lights, &pixels, i, j);
+                        rays_traced += thread_rays - rays_before;
+                        int left = --remaining;
+                        lock_guard<mutex> lock(log_m);
+                        clog << "\rTiles remaining: " << left << ' ' << flush;
+                    });
                 }
             }
+            pool.wait(tiles);
 
             clog << "\rDone.                 \n";
+            if (adaptive_error > 0.0f) spend_saved_samples(world, lights, pixels);
         }
 
+        // Makes a running render skip its remaining tiles, e.g. once the display window is closed
+        void stop() { stop_requested = true; }
+
+        // Samples each pixel took in the last render, aa_samples everywhere unless sampling is
+        // adaptive, where it ranges from min_samples up past aa_samples
+        const vector<int>& samples_per_pixel() const { return sample_count; }
+
+        // Seconds, BVH node visits and primitive tests each pixel cost in the last render with
+        // cost_map set. The wavefront renderer traces paths of many pixels together and doesn't
+        // measure them.
+        const vector<float>& seconds_per_pixel() const { return pixel_seconds; }
+        const vector<float>& nodes_per_pixel() const { return pixel_nodes; }
+        const vector<float>& tests_per_pixel() const { return pixel_tests; }
+
+        // Camera and bounce rays intersected with the world in the last render
+        uint64_t rays() const { return rays_traced; }
+
         //move this to gpu later
         void generate_rays(float pts[], float dirs[]) {
             for (int j = 0; j < image_height; j++) {
                 for (int i = 0; i < image_width; i++) {
                     vec3 pixel_color;
                     for (int sample = 0; sample < aa_samples; ++sample) {
-                        ray r = get_ray(i, j);
+                        sampler rng(seed, i + j * image_width, sample);
+                        ray r = get_ray(i, j, rng);
                         pts[ sample * image_height * image_width * 4 + j * image_width * 4 + i * 4]     = r.pt().x;
                         pts[ sample * image_height * image_width * 4 + j * image_width * 4 + i * 4 + 1] = r.pt().y;
                         pts[ sample * image_height * image_width * 4 + j * image_width * 4 + i * 4 + 2] = r.pt().z;
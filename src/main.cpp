@@ -2,11 +2,19 @@
 // Replace this with imGUI one day
 
 #include <thread>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
 
 #include "scenes.h"
 
 #include "utility/bvh.h"
+#include "utility/bvh_wide.h"
 #include "utility/InputParser.h"
+#include "utility/alloc_counter.h"
+#include "utility/peak_memory.h"
+#include "utility/scene_loader.h"
+#include "utility/transform_baker.h"
 
 #include "raytracer.h"
 #include "camera.h"
@@ -77,31 +85,89 @@ sf::Image display(vector<uint8_t>& pixels, sf::Vector2u size, onb basis) {
     return texture.copyToImage();
 }
 
-int main(int argc, char** argv) {
-
-    InputParser input(argc, argv);
-    if (input.cmdOptionExists("-h") || input.cmdOptionExists("--help") || !input.valid()) {
-        InputParser::helpMessage();
-        return -1;
+// Saves the samples each pixel took as a heatmap, blue for none up to red for aa_samples, or for
+// the most sampled pixel when adaptive sampling went past it
+void save_sample_map(const camera& cam, int max_samples, const string& file) {
+    const vector<int>& counts = cam.samples_per_pixel();
+    for (int n : counts) max_samples = max(max_samples, n);
+    vector<uint8_t> heat(counts.size() * 4);
+    uint64_t total = 0;
+    for (size_t p = 0; p < counts.size(); ++p) {
+        write_heat(heat, float(counts[p]) / max_samples, int(p) * 4);
+        total += counts[p];
     }
+    cout << "Average samples per pixel: " << double(total) / counts.size() << '\n';
 
-    string output_file = input.getCmdOption("--out");
-    bool save = !output_file.empty();
-    if (save) cout << "Saving to " << output_file << '\n';
+    sf::Image image({ (unsigned int)cam.width(), (unsigned int)cam.height() }, heat.data());
+    if (image.saveToFile(file)) cout << "Successfully created " << file << '\n';
+    else cout << "Failed to write sample map\n";
+}
 
-    bool window_display = input.cmdOptionExists("--display");
-    if (window_display) cout << "Showing display\n";
+// Writes values as a one channel PFM, the raw float image format most image tools read. Rows are
+// stored bottom to top, and the negative scale marks the floats as little endian.
+bool write_pfm(const string& file, const vector<float>& values, int width, int height) {
+    ofstream out(file, ios::binary);
+    if (!out) return false;
+    out << "Pf\n" << width << ' ' << height << "\n-1\n";
+    for (int j = height - 1; j >= 0; --j)
+        out.write(reinterpret_cast<const char*>(values.data() + size_t(j) * width), width * sizeof(float));
+    return bool(out);
+}
 
-    bool tree = input.cmdOptionExists("--bvh");
+// Saves the seconds, BVH node visits and primitive tests each pixel cost as heatmaps next to file,
+// e.g. cost_time.png for cost.png, and the raw values as PFM images with the same names. The
+// heatmaps use a log scale relative to the mean, blue for free pixels up to red for the most
+// expensive one, so a few pathological pixels don't wash out the rest.
+void save_cost_map(const camera& cam, const string& file) {
+    if (cam.wavefront) {
+        cout << "The wavefront renderer doesn't measure a cost map\n";
+        return;
+    }
 
-    int scene = 0;
-    string scene_str = input.getCmdOption("--scene");
-    if (!scene_str.empty()) scene = stoi(scene_str);
+    filesystem::path path(file);
+    string extension = path.has_extension() ? path.extension().string() : ".png";
+    struct cost { const char* name; const vector<float>& values; };
+    cost maps[] = {
+        { "time", cam.seconds_per_pixel() },
+        { "nodes", cam.nodes_per_pixel() },
+        { "tests", cam.tests_per_pixel() }
+    };
+
+    for (const cost& map : maps) {
+        float max_value = 0.0f;
+        double total = 0.0;
+        for (float v : map.values) {
+            max_value = max(max_value, v);
+            total += v;
+        }
+        if (max_value <= 0.0f) {
+            cout << "No " << map.name << " cost map, BVH nodes and primitive tests are only counted with RAYTRACER_STATS\n";
+            continue;
+        }
+        float mean = float(total / map.values.size());
+        cout << "Cost per pixel (" << map.name << "): mean " << mean << ", max " << max_value << '\n';
+
+        vector<uint8_t> heat(map.values.size() * 4);
+        float scale = 1.0f / log1p(max_value / mean);
+        for (size_t p = 0; p < map.values.size(); ++p)
+            write_heat(heat, log1p(map.values[p] / mean) * scale, int(p) * 4);
+
+        filesystem::path stem = path.parent_path() / (path.stem().string() + "_" + map.name);
+        string image_file = stem.string() + extension;
+        string raw_file = stem.string() + ".pfm";
+        sf::Image image({ (unsigned int)cam.width(), (unsigned int)cam.height() }, heat.data());
+        if (image.saveToFile(image_file) && write_pfm(raw_file, map.values, cam.width(), cam.height()))
+            cout << "Successfully created " << image_file << " and " << raw_file << '\n';
+        else cout << "Failed to write " << map.name << " cost map\n";
+    }
+}
 
-    config cf;
+// Builds scene number scene into world and lights, and sets the scene's camera defaults in cf
+void load_builtin_scene(int scene, config& cf, const InputParser& input, hittable_list& world, hittable_list& lights) {
+    int tesselation = 0;
+    string tesselate_str = input.getCmdOption("--tesselate");
+    if (!tesselate_str.empty()) tesselation = stoi(tesselate_str);
 
-    hittable_list world;
-    hittable_list lights;
     pair<hittable_list, hittable_list> out;
     switch (scene) {
         default:
@@ -147,7 +213,7 @@ int main(int argc, char** argv) {
             lights = out.second;
             break;
         case 10:
-            out = bezier(cf);
+            out = bezier(cf, tesselation);
             world = out.first;
             lights = out.second;
             break;
@@ -156,24 +222,247 @@ int main(int argc, char** argv) {
             world = out.first;
             lights = out.second;
             break;
+        case 12:
+            out = mesh_scene(cf, input.getCmdOption("--mesh"));
+            world = out.first;
+            lights = out.second;
+            break;
     }
+}
+
+// Whether --scene names a scene file rather than the number of a built-in scene
+bool is_scene_file(const string& scene) {
+    return !scene.empty() && scene.find_first_not_of("0123456789") != string::npos;
+}
+
+// Builds the scene --scene names, a built-in scene number or a scene file, into world and lights,
+// and sets its camera defaults in cf, then bakes its transforms into its primitives unless
+// --keep_transforms is given. Returns false if a scene file failed to load.
+bool load_scene(const string& scene, config& cf, const InputParser& input, hittable_list& world, hittable_list& lights) {
+    if (is_scene_file(scene)) {
+        string cache_dir = input.getCmdOption("--scene_cache");
+        if (input.cmdOptionExists("--scene_cache") && (cache_dir.empty() || cache_dir[0] == '-')) cache_dir = "cache";
+        if (!load_scene_file(scene, cf, world, lights, cache_dir)) return false;
+    } else {
+        load_builtin_scene(scene.empty() ? 0 : stoi(scene), cf, input, world, lights);
+    }
+
+    if (!input.cmdOptionExists("--keep_transforms")) {
+        transform_baker baker;
+        baker.bake(world);
+        baker.bake(lights);
+        if (baker.transforms_baked() > 0)
+            cout << "Transforms baked into geometry: " << baker.transforms_baked() << '\n';
+    }
+    return true;
+}
+
+// Puts world under the acceleration structure named by --bvh
+hittable_list build_bvh(const hittable_list& world, const string& bvh_str) {
+    if (bvh_str == "flat") return hittable_list(make_shared<bvh_tree>(world));
+    if (bvh_str == "wide4") return hittable_list(make_shared<bvh_wide<4>>(world));
+    if (bvh_str == "wide8") return hittable_list(make_shared<bvh_wide<8>>(world));
+    return hittable_list(make_shared<bvh_node>(world));
+}
+
+// s as a quoted JSON string, scene file paths can hold backslashes and quotes
+string json_string(const string& s) {
+    string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + '"';
+}
+
+// Renders the built-in scenes at a fixed size, sample count and seed, and writes the timings
+// of each to json_file so runs can be compared across commits. --scene picks a single scene
+// or scene file, scene 12 is only included when --mesh names a file, and --width, --aa_samples,
+// --seed and --bvh replace the fixed settings. Peak memory is peak_rss_mb, measured per scene,
+// where the peak can be reset (Linux), and process_peak_rss_mb, the largest so far, elsewhere.
+int run_benchmark(const InputParser& input, const string& json_file) {
+    static const char* scene_names[] = {"test", "bouncing_balls", "checkered_spheres", "earth", "perlin_spheres",
+                                        "quads", "simple_light", "cornell_box", "cornell_smoke", "final_scene",
+                                        "bezier", "scene_mirror", "mesh_scene"};
+
+    vector<string> suite;
+    string scene_str = input.getCmdOption("--scene");
+    if (!scene_str.empty()) {
+        suite.push_back(scene_str);
+    } else {
+        for (int scene = 0; scene <= 11; ++scene) suite.push_back(to_string(scene));
+        if (!input.getCmdOption("--mesh").empty()) suite.push_back("12");
+    }
+
+    string bvh_str = input.getCmdOption("--bvh");
+    if (bvh_str.empty()) bvh_str = "flat";
+
+    ofstream json(json_file);
+    if (!json) {
+        cerr << "ERROR: Could not open " << json_file << " for the benchmark results.\n";
+        return -1;
+    }
+
+    config fixed;
+    fixed.image_width = 320;
+    fixed.aa_samples = 16;
+    fixed.seed = 0;
+    configure(input, fixed);
+
+    json << "{\n";
+    json << "  \"width\": " << fixed.image_width << ",\n";
+    json << "  \"aa_samples\": " << fixed.aa_samples << ",\n";
+    json << "  \"seed\": " << fixed.seed << ",\n";
+    json << "  \"bvh\": " << json_string(bvh_str) << ",\n";
+    json << "  \"threads\": " << thread_pool::global().size() << ",\n";
+    json << "  \"scenes\": [";
+
+    for (size_t k = 0; k < suite.size(); ++k) {
+        const string& scene = suite[k];
+        cout << "Benchmarking scene " << scene << '\n';
+
+        bool own_peak = reset_peak_rss();
+        auto scene_start = chrono::steady_clock::now();
+        seed_random(fixed.seed);
+        config cf;
+        hittable_list world;
+        hittable_list lights;
+        if (!load_scene(scene, cf, input, world, lights)) return -1;
+        cf.image_width = fixed.image_width;
+        cf.aa_samples = fixed.aa_samples;
+        cf.seed = fixed.seed;
+        configure(input, cf);
+        chrono::duration<double, milli> scene_time = chrono::steady_clock::now() - scene_start;
+
+        auto build_start = chrono::steady_clock::now();
+        world = build_bvh(world, bvh_str);
+        chrono::duration<double, milli> build_time = chrono::steady_clock::now() - build_start;
+
+        camera cam(cf);
+        vector<uint8_t> pixels(cam.width() * cam.height() * 4);
+#ifdef RAYTRACER_STATS
+        render_stats::reset();
+#endif
+        auto render_start = chrono::steady_clock::now();
+        cam.render(world, lights, pixels);
+        chrono::duration<double> render_time = chrono::steady_clock::now() - render_start;
+
+        uint64_t samples = 0;
+        for (int n : cam.samples_per_pixel()) samples += n;
+        double seconds = max(render_time.count(), 1e-9);
+
+        string name;
+        if (is_scene_file(scene)) {
+            name = filesystem::path(scene).stem().string();
+        } else {
+            int number = stoi(scene);
+            name = number >= 0 && number <= 12 ? scene_names[number] : scene_names[0];
+        }
+        json << (k ? "," : "") << "\n    {\n";
+        if (is_scene_file(scene)) json << "      \"scene\": " << json_string(scene) << ",\n";
+        else json << "      \"scene\": " << scene << ",\n";
+        json << "      \"name\": " << json_string(name) << ",\n";
+        json << "      \"width\": " << cam.width() << ",\n";
+        json << "      \"height\": " << cam.height() << ",\n";
+        json << "      \"scene_build_ms\": " << scene_time.count() << ",\n";
+        json << "      \"bvh_build_ms\": " << build_time.count() << ",\n";
+        json << "      \"render_s\": " << render_time.count() << ",\n";
+        json << "      \"rays\": " << cam.rays() << ",\n";
+        json << "      \"rays_per_second\": " << cam.rays() / seconds << ",\n";
+        json << "      \"samples\": " << samples << ",\n";
+        json << "      \"samples_per_second\": " << samples / seconds << ",\n";
+        // Where the peak can't be reset it is the largest of all the scenes run so far
+        json << (own_peak ? "      \"peak_rss_mb\": " : "      \"process_peak_rss_mb\": ")
+             << peak_rss_bytes() / (1024.0 * 1024.0);
+#ifdef RAYTRACER_STATS
+        json << ",\n      \"stats\": ";
+        render_stats::write_json(json, "      ");
+#endif
+        json << "\n";
+        json << "    }";
+
+        cout << name << ": render " << render_time.count() << " s, "
+             << cam.rays() / seconds / 1e6 << " Mrays/s, " << samples / seconds / 1e6 << " Msamples/s\n";
+    }
+
+    json << "\n  ]\n}\n";
+    cout << "Benchmark results written to " << json_file << '\n';
+    return 0;
+}
+
+int main(int argc, char** argv) {
+
+    InputParser input(argc, argv);
+    if (input.cmdOptionExists("-h") || input.cmdOptionExists("--help") || !input.valid()) {
+        InputParser::helpMessage();
+        return -1;
+    }
+
+    string output_file = input.getCmdOption("--out");
+    bool save = !output_file.empty();
+    if (save) cout << "Saving to " << output_file << '\n';
+
+    string sample_map_file = input.getCmdOption("--sample_map");
+
+    string cost_map_file = input.getCmdOption("--cost_map");
+    if (input.cmdOptionExists("--cost_map") && (cost_map_file.empty() || cost_map_file[0] == '-'))
+        cost_map_file = "cost_map.png";
+
+    bool window_display = input.cmdOptionExists("--display");
+    if (window_display) cout << "Showing display\n";
+
+    bool tree = input.cmdOptionExists("--bvh");
+    const string& bvh_str = input.getCmdOption("--bvh");
+    // Scenes may build their own trees, so pick the builder before building them
+    if (input.getCmdOption("--bvh_build") == "binned") bvh_node::default_build = bvh_build::binned;
+
+    string threads_str = input.getCmdOption("--threads");
+    if (!threads_str.empty()) thread_pool::configured_threads = stoi(threads_str);
+
+    // Scenes scatter random objects while being built, so seed before building them
+    string seed_str = input.getCmdOption("--seed");
+    if (!seed_str.empty()) seed_random(stoull(seed_str));
+
+    if (input.cmdOptionExists("--benchmark")) {
+        string json_file = input.getCmdOption("--benchmark");
+        if (json_file.empty() || json_file[0] == '-') json_file = "benchmark.json";
+        return run_benchmark(input, json_file);
+    }
+
+    config cf;
+
+    hittable_list world;
+    hittable_list lights;
+    if (!load_scene(input.getCmdOption("--scene"), cf, input, world, lights)) return -1;
 
     configure(input, cf);
 
     camera cam(cf);
     onb basis = cam.basis();
-    if (tree) world = hittable_list(make_shared<bvh_node>(world));
+    if (tree) {
+        auto build_start = chrono::steady_clock::now();
+        world = build_bvh(world, bvh_str);
+        chrono::duration<double, milli> build_time = chrono::steady_clock::now() - build_start;
+        cout << "BVH build time: " << build_time.count() << " ms\n";
+    }
 
     vector<uint8_t> pixels(cam.width() * cam.height() * 4);
-    vector<thread> threads;
-    threads.reserve(cam.width() * cam.height() / (cf.tw * cf.th));
 
     if (window_display) {
-        thread render(&camera::render, &cam, ref(world), ref(lights), ref(pixels), ref(threads));
+        thread render(&camera::render, &cam, ref(world), ref(lights), ref(pixels));
 
         sf::Image image(display(pixels, { (unsigned int)cam.width(), (unsigned int)cam.height() }, basis));
 
-        for (thread& t : threads) if (t.joinable()) t.join();
+        cam.stop();
+        render.join();
 
         if (save) {
             bool success = image.saveToFile(output_file);
@@ -181,8 +470,17 @@ int main(int argc, char** argv) {
             else cout << "Failed to write image\n";
         }
     } else {
-        cam.render(world, lights, pixels, threads);
-        for (thread& t : threads) if (t.joinable()) t.join();
+#ifdef RAYTRACER_COUNT_ALLOCATIONS
+        uint64_t allocations_before = alloc_counter::count();
+#endif
+        auto render_start = chrono::steady_clock::now();
+        cam.render(world, lights, pixels);
+        chrono::duration<double> render_time = chrono::steady_clock::now() - render_start;
+        cout << "Render time: " << render_time.count() << " s\n";
+#ifdef RAYTRACER_COUNT_ALLOCATIONS
+        cout << "Heap allocations during render: " << alloc_counter::count() - allocations_before
+             << " (" << uint64_t(cam.width()) * cam.height() * cf.aa_samples << " samples)\n";
+#endif
 
         if (save) {
             sf::Image image({ (unsigned int)cam.width(), (unsigned int)cam.height()}, pixels.data());
@@ -191,5 +489,11 @@ int main(int argc, char** argv) {
             else cout << "Failed to write image\n";
         }
     }
+
+    if (!sample_map_file.empty()) save_sample_map(cam, cf.aa_samples, sample_map_file);
+    if (!cost_map_file.empty()) save_cost_map(cam, cost_map_file);
+#ifdef RAYTRACER_STATS
+    render_stats::print(cout);
+#endif
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,70 @@
+#ifndef AFFINE_H
+#define AFFINE_H
+
+#include "quat.h"
+#include "ray.h"
+
+// 3x4 affine transform, a linear part and a translation, stored as its four columns so
+// transforming a point is three scaled vec3 adds. Rotations and translations are taken from
+// dquat, so an affine built from a transform_o's dual quaternion moves points the same way, but
+// applying it costs a handful of vector ops instead of two quaternion products.
+class affine {
+    public:
+        vec3 c[3];  // columns of the linear part
+        vec3 t;     // translation
+
+        affine() : c{vec3(1.0f, 0.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f), vec3(0.0f, 0.0f, 1.0f)}, t(0.0f) {}
+        affine(const vec3& c0, const vec3& c1, const vec3& c2, const vec3& t) : c{c0, c1, c2}, t(t) {}
+
+        // The rigid motion of dq, a product of dquat::rotate and dquat::translate
+        explicit affine(const dquat& dq) {
+            const quat& q = dq.p;
+            float s = 2.0f / q.norm_squared();
+            float x = q.v.x, y = q.v.y, z = q.v.z, w = q.s;
+            c[0] = vec3(1.0f - s * (y * y + z * z), s * (x * y + w * z), s * (x * z - w * y));
+            c[1] = vec3(s * (x * y - w * z), 1.0f - s * (x * x + z * z), s * (y * z + w * x));
+            c[2] = vec3(s * (x * z + w * y), s * (y * z - w * x), 1.0f - s * (x * x + y * y));
+            t = dq.transform(vec3());
+        }
+
+        static affine rotate(float theta, const vec3& axis, bool radians = false) {
+            if (!radians) theta = degrees_to_radians(theta);
+            return affine(dquat::rotate(theta, axis));
+        }
+
+        static affine translate(const vec3& offset) { return affine(dquat::translate(offset)); }
+
+        static affine scale(const vec3& s) {
+            return affine(vec3(s.x, 0.0f, 0.0f), vec3(0.0f, s.y, 0.0f), vec3(0.0f, 0.0f, s.z), vec3(0.0f));
+        }
+
+        vec3 vector(const vec3& v) const { return c[0] * v.x + c[1] * v.y + c[2] * v.z; }
+
+        vec3 point(const vec3& p) const { return vector(p) + t; }
+
+        // The transposed linear part applied to v. Surface normals go from object to world space
+        // through the transpose of the world to object transform.
+        vec3 transposed(const vec3& v) const { return vec3(dot(c[0], v), dot(c[1], v), dot(c[2], v)); }
+
+        // The direction isn't renormalized, so a hit's t is the same on both sides
+        ray transform(const ray& r) const { return ray(point(r.pt()), vector(r.dir()), r.time()); }
+
+        affine inverse() const {
+            // Rows of the inverse are the cross products of pairs of columns over the determinant
+            vec3 r0 = cross(c[1], c[2]), r1 = cross(c[2], c[0]), r2 = cross(c[0], c[1]);
+            float inv_det = 1.0f / dot(c[0], r0);
+            r0 = r0 * inv_det;
+            r1 = r1 * inv_det;
+            r2 = r2 * inv_det;
+            affine inv(vec3(r0.x, r1.x, r2.x), vec3(r0.y, r1.y, r2.y), vec3(r0.z, r1.z, r2.z), vec3(0.0f));
+            inv.t = -inv.vector(t);
+            return inv;
+        }
+};
+
+// a applied after b
+inline affine operator*(const affine& a, const affine& b) {
+    return affine(a.vector(b.c[0]), a.vector(b.c[1]), a.vector(b.c[2]), a.point(b.t));
+}
+
+#endif
@@ -10,7 +10,7 @@ class pdf {
         virtual ~pdf() {}
 
         virtual float value(const vec3& direction) const = 0;
-        virtual vec3 generate() const = 0;
+        virtual vec3 generate(sampler& rng) const = 0;
 };
 
 class sphere_pdf : public pdf {
@@ -21,8 +21,8 @@ class sphere_pdf : public pdf {
             return 1.0f / (4.0f * pi);
         }
 
-        vec3 generate() const override {
-            return random_unit_vector();
+        vec3 generate(sampler& rng) const override {
+            return random_unit_vector(rng);
         }
 };
 
@@ -38,8 +38,8 @@ class cosine_pdf : public pdf {
             return std::fmax(0.0f, cosine_theta / pi);
         }
 
-        vec3 generate() const override {
-            return uvw.transform(random_cosine_direction());
+        vec3 generate(sampler& rng) const override {
+            return uvw.transform(random_cosine_direction(rng));
         }
 };
 
@@ -55,27 +55,29 @@ class hittable_pdf : public pdf {
             return objects.pdf_value(origin, direction);
         }
 
-        vec3 generate() const override {
-            return objects.random(origin);
+        vec3 generate(sampler& rng) const override {
+            return objects.random(origin, rng);
         }
 };
 
+// Mixes two pdfs that live on the caller's stack, so building one costs no allocation
 class mixture_pdf : public pdf {
     private:
-        shared_ptr<pdf> p0, p1;
+        const pdf& p0;
+        const pdf& p1;
         float w;
     
     public:
-        mixture_pdf(shared_ptr<pdf> p0, shared_ptr<pdf> p1, float w) : 
+        mixture_pdf(const pdf& p0, const pdf& p1, float w) : 
             p0(p0), p1(p1), w(std::clamp(w, 0.0f, 1.0f)) {}
 
         float value(const vec3& direction) const override {
-            return w * p0->value(direction) + (1 - w) * p1->value(direction);
+            return w * p0.value(direction) + (1 - w) * p1.value(direction);
         }
 
-        vec3 generate() const override {
-            if (random_float() < w) return p0->generate();
-            else return p1->generate();
+        vec3 generate(sampler& rng) const override {
+            if (rng.next_float() < w) return p0.generate(rng);
+            else return p1.generate(rng);
         }
 };
 
@@ -3,11 +3,42 @@
 
 #include "../raytracer.h"
 
+#include <utility>
+
+// Per ray setup of the watertight triangle test in triangle_intersect.h: the axes permuted so
+// kz is the largest direction component, and the shear that takes the direction to +z.
+struct ray_shear {
+    unsigned char kx, ky, kz;
+    float sx, sy, sz;
+
+    ray_shear() {}
+
+    explicit ray_shear(const vec3& d) {
+        int x, y, z = 0;
+        if (std::fabs(d.y) > std::fabs(d[z])) z = 1;
+        if (std::fabs(d.z) > std::fabs(d[z])) z = 2;
+        x = z == 2 ? 0 : z + 1;
+        y = x == 2 ? 0 : x + 1;
+        if (d[z] < 0.0f) std::swap(x, y);  // keep the triangle winding
+
+        kx = x;
+        ky = y;
+        kz = z;
+        sz = 1.0f / d[z];
+        sx = d[x] * sz;
+        sy = d[y] * sz;
+    }
+};
+
 class ray {
     private:
         vec3 point;
         vec3 direction;
         float tm;
+        // Filled in by the first triangle the ray is tested against, so a traversal sets it
+        // up once rather than per primitive
+        mutable bool sheared = false;
+        mutable ray_shear shear_setup;
     
     public:
         ray() {}
@@ -21,9 +52,17 @@ class ray {
         const vec3& dir() const { return direction; }
         float time() const { return tm; }
 
+        const ray_shear& shear() const {
+            if (!sheared) {
+                shear_setup = ray_shear(direction);
+                sheared = true;
+            }
+            return shear_setup;
+        }
+
         vec3 at(float t) const {
             return point + t * direction;
         }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,120 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "ray.h"
+#include "triangle_intersect.h"
+#include "../utility/simd.h"
+
+// Eight rays stored as SoA rows so one box or primitive test runs across all of them. Lanes
+// are addressed by bit k of an int mask.
+struct ray_packet {
+    static const int size = 8;
+    static const int all = (1 << size) - 1;
+
+    alignas(32) float o[3][size];     // origins
+    alignas(32) float d[3][size];     // directions
+    alignas(32) float inv_d[3][size]; // 1 / direction, for the slab tests
+    alignas(32) float tmax[size];     // closest hit so far
+    float time[size];
+    ray_shear shear[size];            // per lane setup of the watertight triangle test
+    float tmin;
+
+    void set(int k, const ray& r) {
+        for (int a = 0; a < 3; ++a) {
+            o[a][k] = r.pt()[a];
+            d[a][k] = r.dir()[a];
+            inv_d[a][k] = 1.0f / r.dir()[a];
+        }
+        time[k] = r.time();
+        shear[k] = r.shear();
+    }
+
+    vec3 origin(int k) const { return vec3(o[0][k], o[1][k], o[2][k]); }
+
+    ray lane(int k) const {
+        return ray(vec3(o[0][k], o[1][k], o[2][k]), vec3(d[0][k], d[1][k], d[2][k]), time[k]);
+    }
+
+    static int first_lane(int mask) {
+        int k = 0;
+        while (!(mask & (1 << k))) ++k;
+        return k;
+    }
+
+    // Mask of the lanes in mask whose ray enters the box before its current closest hit
+    int hit_box(const float* bmin, const float* bmax, int mask) const {
+#if defined(RAYTRACER_SSE)
+        int hits = 0;
+        __m128 t_min = _mm_set1_ps(tmin);
+        for (int k = 0; k < size; k += 4) {
+            __m128 t_enter = t_min;
+            __m128 t_exit = _mm_load_ps(tmax + k);
+            for (int a = 0; a < 3; ++a) {
+                __m128 o_a = _mm_load_ps(o[a] + k);
+                __m128 inv = _mm_load_ps(inv_d[a] + k);
+                __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmin[a]), o_a), inv);
+                __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(bmax[a]), o_a), inv);
+                t_enter = _mm_max_ps(t_enter, _mm_min_ps(t0, t1));
+                t_exit = _mm_min_ps(t_exit, _mm_max_ps(t0, t1));
+            }
+            hits |= _mm_movemask_ps(_mm_cmplt_ps(t_enter, t_exit)) << k;
+        }
+        return hits & mask;
+#elif defined(RAYTRACER_NEON)
+        static const uint32_t lane_bits[4] = {1, 2, 4, 8};
+        uint32x4_t bits = vld1q_u32(lane_bits);
+        int hits = 0;
+        for (int k = 0; k < size; k += 4) {
+            float32x4_t t_enter = vdupq_n_f32(tmin);
+            float32x4_t t_exit = vld1q_f32(tmax + k);
+            for (int a = 0; a < 3; ++a) {
+                float32x4_t o_a = vld1q_f32(o[a] + k);
+                float32x4_t inv = vld1q_f32(inv_d[a] + k);
+                float32x4_t t0 = vmulq_f32(vsubq_f32(vdupq_n_f32(bmin[a]), o_a), inv);
+                float32x4_t t1 = vmulq_f32(vsubq_f32(vdupq_n_f32(bmax[a]), o_a), inv);
+                t_enter = vmaxq_f32(t_enter, vminq_f32(t0, t1));
+                t_exit = vminq_f32(t_exit, vmaxq_f32(t0, t1));
+            }
+            hits |= int(vaddvq_u32(vandq_u32(vcltq_f32(t_enter, t_exit), bits))) << k;
+        }
+        return hits & mask;
+#else
+        int hits = 0;
+        for (int k = 0; k < size; ++k) {
+            float t_enter = tmin;
+            float t_exit = tmax[k];
+            for (int a = 0; a < 3; ++a) {
+                float t0 = (bmin[a] - o[a][k]) * inv_d[a][k];
+                float t1 = (bmax[a] - o[a][k]) * inv_d[a][k];
+                t_enter = std::max(t_enter, std::min(t0, t1));
+                t_exit = std::min(t_exit, std::max(t0, t1));
+            }
+            hits |= int(t_enter < t_exit) << k;
+        }
+        return hits & mask;
+#endif
+    }
+
+    // Cramer's rule solve of every lane against the plane Q + a*u + b*v, used by quads. Written
+    // as branch free loops over the lanes so the compiler vectorizes them, in the same operation
+    // order as the scalar hit() so both agree on every hit.
+    void solve_planar(const vec3& Q, const vec3& u, const vec3& v,
+                      float* det, float* a, float* b, float* t) const {
+        for (int k = 0; k < size; ++k) {
+            float ndx = -d[0][k], ndy = -d[1][k], ndz = -d[2][k];
+            float oqx = o[0][k] - Q.x, oqy = o[1][k] - Q.y, oqz = o[2][k] - Q.z;
+
+            // determinant(c1, c2, c3) = dot(c2, cross(c3, c1))
+            float vnx = v.y * ndz - v.z * ndy, vny = v.z * ndx - v.x * ndz, vnz = v.x * ndy - v.y * ndx;
+            float onx = oqy * ndz - oqz * ndy, ony = oqz * ndx - oqx * ndz, onz = oqx * ndy - oqy * ndx;
+            float vox = v.y * oqz - v.z * oqy, voy = v.z * oqx - v.x * oqz, voz = v.x * oqy - v.y * oqx;
+
+            det[k] = u.x * vnx + u.y * vny + u.z * vnz;
+            a[k] = (oqx * vnx + oqy * vny + oqz * vnz) / det[k];
+            b[k] = (u.x * onx + u.y * ony + u.z * onz) / det[k];
+            t[k] = (u.x * vox + u.y * voy + u.z * voz) / det[k];
+        }
+    }
+};
+
+#endif
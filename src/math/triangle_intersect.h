@@ -0,0 +1,57 @@
+#ifndef TRIANGLE_INTERSECT_H
+#define TRIANGLE_INTERSECT_H
+
+#include "ray.h"
+
+// Watertight ray/triangle test (Woop, Benthin and Wald, JCGT 2013). The ray is sheared (see
+// ray_shear) so it points down +z from the origin, after which a triangle is tested with 2D
+// edge functions. Neighbouring triangles evaluate a shared edge with the same operands, so a
+// ray can't slip through the crack between them or hit both.
+
+// Tests the triangle p0 p1 p2 from both sides. On a hit inside ray_t, t is the ray parameter
+// and a, b are the weights of p1 and p2.
+inline bool intersect_triangle(const vec3& origin, const ray_shear& s, const vec3& p0, const vec3& p1,
+                               const vec3& p2, const interval& ray_t, float& t, float& a, float& b) {
+    vec3 A = p0 - origin;
+    vec3 B = p1 - origin;
+    vec3 C = p2 - origin;
+
+    float az = A[s.kz], bz = B[s.kz], cz = C[s.kz];
+    float ax = A[s.kx] - s.sx * az, ay = A[s.ky] - s.sy * az;
+    float bx = B[s.kx] - s.sx * bz, by = B[s.ky] - s.sy * bz;
+    float cx = C[s.kx] - s.sx * cz, cy = C[s.ky] - s.sy * cz;
+
+    float U = cx * by - cy * bx;
+    float V = ax * cy - ay * cx;
+    float W = bx * ay - by * ax;
+
+    // A float edge function can only get the wrong sign by rounding to 0. Redo those in double,
+    // where the products of two floats are exact, so every triangle around an edge or vertex
+    // agrees on which side the ray is.
+    if (U == 0.0f || V == 0.0f || W == 0.0f) {
+        U = float(double(cx) * double(by) - double(cy) * double(bx));
+        V = float(double(ax) * double(cy) - double(ay) * double(cx));
+        W = float(double(bx) * double(ay) - double(by) * double(ax));
+    }
+
+    if ((U < 0.0f || V < 0.0f || W < 0.0f) && (U > 0.0f || V > 0.0f || W > 0.0f)) return false;
+
+    float det = U + V + W;
+    if (det == 0.0f) return false;
+
+    float T = U * (s.sz * az) + V * (s.sz * bz) + W * (s.sz * cz);
+    float inv_det = 1.0f / det;
+    t = T * inv_det;
+    if (!ray_t.contains(t)) return false;
+
+    a = V * inv_det;
+    b = W * inv_det;
+    return true;
+}
+
+inline bool intersect_triangle(const ray& r, const vec3& p0, const vec3& p1, const vec3& p2,
+                               const interval& ray_t, float& t, float& a, float& b) {
+    return intersect_triangle(r.pt(), r.shear(), p0, p1, p2, ray_t, t, a, b);
+}
+
+#endif
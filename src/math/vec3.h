@@ -2,55 +2,55 @@
 #define VEC3_H
 
 #include "../raytracer.h"
+#include "../utility/simd.h"
 
 #include <string>
 #include <regex>
 #include <iostream>
 #include <sstream>
 
-class vec3 {
+// With SSE or NEON a vec3 is one 16 byte register with the fourth lane kept at zero, so the
+// arithmetic, dot, cross and normalize below are a few vector instructions each. The lanes are
+// combined in the same order as the scalar fallback, so both give the same bits.
+#if defined(RAYTRACER_SSE)
+    using vec3_register = __m128;
+#elif defined(RAYTRACER_NEON)
+    using vec3_register = float32x4_t;
+#endif
+
+class alignas(16) vec3 {
     public:
         union {
-            struct { float x, y, z; };
+            struct { float x, y, z, w; };   // w is padding, kept at zero so equal vectors have equal bytes
             struct { float i, j, k; };
             float e[3];
+#if defined(RAYTRACER_SSE) || defined(RAYTRACER_NEON)
+            vec3_register m;
+#endif
         };
 
         vec3() : vec3(0) {}
-        vec3(float x_, float y_, float z_) : x(x_), y(y_), z(z_) {}
-        vec3(float d) : x(d), y(d), z(d) {}
-
-        vec3 operator-() const { return vec3(-x, -y, -z); }
+#if defined(RAYTRACER_SSE)
+        vec3(float x_, float y_, float z_) : m(_mm_setr_ps(x_, y_, z_, 0.0f)) {}
+        vec3(float d) : vec3(d, d, d) {}
+        explicit vec3(__m128 m_) : m(m_) {}
+#elif defined(RAYTRACER_NEON)
+        vec3(float x_, float y_, float z_) : m(float32x4_t{x_, y_, z_, 0.0f}) {}
+        vec3(float d) : vec3(d, d, d) {}
+        explicit vec3(float32x4_t m_) : m(m_) {}
+#else
+        vec3(float x_, float y_, float z_) : x(x_), y(y_), z(z_), w(0.0f) {}
+        vec3(float d) : x(d), y(d), z(d), w(0.0f) {}
+#endif
+
+        vec3 operator-() const;
         float operator[](int i) const { return e[i]; }
         float& operator[](int i) { return e[i]; }
 
-        vec3& operator+=(const vec3& v) {
-            x += v.x;
-            y += v.y;
-            z += v.z;
-            return *this;
-        }
-
-        vec3& operator-=(const vec3& v) {
-            x -= v.x;
-            y -= v.y;
-            z -= v.z;
-            return *this;
-        }
-
-        vec3& operator*=(const vec3& v) {
-            x *= v.x;
-            y *= v.x;
-            z *= v.x;
-            return *this;
-        }
-
-        vec3& operator*=(float t) {
-            x *= t;
-            y *= t;
-            z *= t;
-            return *this;
-        }
+        vec3& operator+=(const vec3& v);
+        vec3& operator-=(const vec3& v);
+        vec3& operator*=(const vec3& v);
+        vec3& operator*=(float t);
 
         vec3& operator/=(const vec3& v) {
             x /= v.x;
@@ -63,20 +63,11 @@ class vec3 {
             return *this *= 1.0 / t;
         }
 
-        vec3& operator=(const vec3& v) {
-            x = v.x;
-            y = v.y;
-            z = v.z;
-            return *this;
-        }
-
         float length() const {
             return std::sqrt(length_squared());
         }
 
-        float length_squared() const {
-            return x*x + y*y + z*z;
-        }
+        float length_squared() const;
 
         vec3 dir() const;
 
@@ -116,6 +107,52 @@ inline std::ostream& operator<<(std::ostream& out, const vec3& v) {
     return out << v.x << ' ' << v.y << ' ' << v.z;
 }
 
+#if defined(RAYTRACER_SSE)
+
+inline vec3 operator+(const vec3& u, const vec3& v) { return vec3(_mm_add_ps(u.m, v.m)); }
+inline vec3 operator-(const vec3& u, const vec3& v) { return vec3(_mm_sub_ps(u.m, v.m)); }
+inline vec3 operator*(const vec3& u, const vec3& v) { return vec3(_mm_mul_ps(u.m, v.m)); }
+inline vec3 operator*(float t, const vec3& v) { return vec3(_mm_mul_ps(_mm_set1_ps(t), v.m)); }
+
+// Subtracted from zero rather than sign flipped, which would leave -0 in the fourth lane
+inline vec3 vec3::operator-() const { return vec3(_mm_sub_ps(_mm_setzero_ps(), m)); }
+
+inline float dot(const vec3& u, const vec3& v) {
+    __m128 p = _mm_mul_ps(u.m, v.m);
+    __m128 sum = _mm_add_ss(p, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(_mm_add_ss(sum, _mm_movehl_ps(p, p)));
+}
+
+inline vec3 cross(const vec3& u, const vec3& v) {
+    __m128 u_yzx = _mm_shuffle_ps(u.m, u.m, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 u_zxy = _mm_shuffle_ps(u.m, u.m, _MM_SHUFFLE(3, 1, 0, 2));
+    __m128 v_yzx = _mm_shuffle_ps(v.m, v.m, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 v_zxy = _mm_shuffle_ps(v.m, v.m, _MM_SHUFFLE(3, 1, 0, 2));
+    return vec3(_mm_sub_ps(_mm_mul_ps(u_yzx, v_zxy), _mm_mul_ps(u_zxy, v_yzx)));
+}
+
+#elif defined(RAYTRACER_NEON)
+
+inline vec3 operator+(const vec3& u, const vec3& v) { return vec3(vaddq_f32(u.m, v.m)); }
+inline vec3 operator-(const vec3& u, const vec3& v) { return vec3(vsubq_f32(u.m, v.m)); }
+inline vec3 operator*(const vec3& u, const vec3& v) { return vec3(vmulq_f32(u.m, v.m)); }
+inline vec3 operator*(float t, const vec3& v) { return vec3(vmulq_n_f32(v.m, t)); }
+
+inline vec3 vec3::operator-() const { return vec3(vsubq_f32(vdupq_n_f32(0.0f), m)); }
+
+inline float dot(const vec3& u, const vec3& v) {
+    float32x4_t p = vmulq_f32(u.m, v.m);
+    return vgetq_lane_f32(p, 0) + vgetq_lane_f32(p, 1) + vgetq_lane_f32(p, 2);
+}
+
+inline vec3 cross(const vec3& u, const vec3& v) {
+    return vec3(u.y * v.z - u.z * v.y,
+                u.z * v.x - u.x * v.z,
+                u.x * v.y - u.y * v.x);
+}
+
+#else
+
 inline vec3 operator+(const vec3& u, const vec3& v) {
     return vec3(u.x + v.x, u.y + v.y, u.z + v.z);
 }
@@ -132,6 +169,27 @@ inline vec3 operator*(float t, const vec3& v) {
     return vec3(t * v.x, t * v.y, t * v.z);
 }
 
+inline vec3 vec3::operator-() const { return vec3(-x, -y, -z); }
+
+inline float dot(const vec3& u, const vec3& v) {
+    return u.x * v.x + u.y * v.y + u.z * v.z;
+}
+
+inline vec3 cross(const vec3& u, const vec3& v) {
+    return vec3(u.y * v.z - u.z * v.y,
+                u.z * v.x - u.x * v.z,
+                u.x * v.y - u.y * v.x);
+}
+
+#endif
+
+inline vec3& vec3::operator+=(const vec3& v) { return *this = *this + v; }
+inline vec3& vec3::operator-=(const vec3& v) { return *this = *this - v; }
+inline vec3& vec3::operator*=(const vec3& v) { return *this = *this * v; }
+inline vec3& vec3::operator*=(float t) { return *this = t * *this; }
+
+inline float vec3::length_squared() const { return dot(*this, *this); }
+
 inline vec3 operator*(const vec3& v, float t) {
     return t * v;
 }
@@ -144,19 +202,9 @@ vec3 vec3::dir() const {
     return *this / length();
 }
 
-inline float dot(const vec3& u, const vec3& v) {
-    return u.x * v.x + u.y * v.y + u.z * v.z;
-}
-
-inline vec3 cross(const vec3& u, const vec3& v) {
-    return vec3(u.y * v.z - u.z * v.y,
-                u.z * v.x - u.x * v.z,
-                u.x * v.y - u.y * v.x);
-}
-
-inline vec3 random_unit_vector() {
-    float r1 = random_float();
-    float r2 = random_float();
+inline vec3 random_unit_vector(sampler& rng) {
+    float r1 = rng.next_float();
+    float r2 = rng.next_float();
 
     float phi = 2.0f * pi * r1;
     float sin_theta = 2.0f * sqrt(r2 * (1 - r2));
@@ -167,21 +215,21 @@ inline vec3 random_unit_vector() {
     return vec3(x, y, z);
 }
 
-inline vec3 random_on_hemisphere(const vec3& normal) {
-    vec3 random_v = random_unit_vector();
+inline vec3 random_on_hemisphere(const vec3& normal, sampler& rng) {
+    vec3 random_v = random_unit_vector(rng);
     return (dot(random_v, normal) > 0.0f) ? random_v : -random_v;
 }
 
-inline vec3 random_in_unit_disk() {
+inline vec3 random_in_unit_disk(sampler& rng) {
     while (true) {
-        vec3 p = vec3(random_float(-1.0f, 1.0f), random_float(-1.0f, 1.0f), 0.0f);
+        vec3 p = vec3(rng.next_float(-1.0f, 1.0f), rng.next_float(-1.0f, 1.0f), 0.0f);
         if (p.length_squared() < 1.0f) return p;
     }
 }
 
-inline vec3 random_cosine_direction() {
-    float r1 = random_float();
-    float r2 = random_float();
+inline vec3 random_cosine_direction(sampler& rng) {
+    float r1 = rng.next_float();
+    float r2 = rng.next_float();
 
     float phi = 2.0f * pi * r1;
     float sqrtr2 = sqrt(r2);
@@ -1,14 +1,23 @@
 #ifndef BEZIER_H
-#define BEZIDER_H
+#define BEZIER_H
 
 #include "../math/vec3.h"
 #include "../math/mat4.h"
+#include "../math/affine.h"
 #include "triangle.h"
 #include "patch.h"
 #include "hittable_list.h"
 #include "material.h"
+#include "../utility/bvh.h"
+#include "../utility/thread_pool.h"
 
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
 
 const mat4 basis
     (
@@ -51,10 +60,30 @@ class bezier_curve {
 class bezier_patch {
     private:
         mat4 x, y, z;
+        vec3 cp[4][4];  // control points, row i along v and column j along u
+
+        // Point of the cubic with control points p at blossom (t1, t2, t3), de Casteljau with a
+        // different parameter per level. (a, a, a), (a, a, b), (a, b, b), (b, b, b) are the
+        // control points of the piece of the curve between a and b.
+        static vec3 blossom(const vec3* p, float t1, float t2, float t3) {
+            vec3 q0 = (1.0f - t1) * p[0] + t1 * p[1];
+            vec3 q1 = (1.0f - t1) * p[1] + t1 * p[2];
+            vec3 q2 = (1.0f - t1) * p[2] + t1 * p[3];
+            vec3 r0 = (1.0f - t2) * q0 + t2 * q1;
+            vec3 r1 = (1.0f - t2) * q1 + t2 * q2;
+            return (1.0f - t3) * r0 + t3 * r1;
+        }
+
+        void set_control_points(const mat4& px, const mat4& py, const mat4& pz) {
+            for (int i = 0; i < 4; ++i)
+                for (int j = 0; j < 4; ++j) cp[i][j] = vec3(px[i][j], py[i][j], pz[i][j]);
+        }
 
     public:
         bezier_patch(const mat4& x, const mat4& y, const mat4& z) : 
-                    x(basis*x*basis), y(basis*y*basis), z(basis*z*basis) {}
+                    x(basis*x*basis), y(basis*y*basis), z(basis*z*basis) {
+            set_control_points(x, y, z);
+        }
 
         bezier_patch(const vec3& v0,  const vec3& v1,  const vec3& v2,  const vec3& v3,
                      const vec3& v4,  const vec3& v5,  const vec3& v6,  const vec3& v7,
@@ -71,8 +100,29 @@ class bezier_patch {
                     z(basis * mat4(v0.z,  v1.z,  v2.z,  v3.z,
                                    v4.z,  v5.z,  v6.z,  v7.z,
                                    v8.z,  v9.z,  v10.z, v11.z,
-                                   v12.z, v13.z, v14.z, v15.z) * basis) {}
+                                   v12.z, v13.z, v14.z, v15.z) * basis) {
+            set_control_points(mat4(v0.x,  v1.x,  v2.x,  v3.x,  v4.x,  v5.x,  v6.x,  v7.x,
+                                    v8.x,  v9.x,  v10.x, v11.x, v12.x, v13.x, v14.x, v15.x),
+                               mat4(v0.y,  v1.y,  v2.y,  v3.y,  v4.y,  v5.y,  v6.y,  v7.y,
+                                    v8.y,  v9.y,  v10.y, v11.y, v12.y, v13.y, v14.y, v15.y),
+                               mat4(v0.z,  v1.z,  v2.z,  v3.z,  v4.z,  v5.z,  v6.z,  v7.z,
+                                    v8.z,  v9.z,  v10.z, v11.z, v12.z, v13.z, v14.z, v15.z));
+        }
         
+        // The same patch with its control points moved, a bezier patch is affine invariant
+        bezier_patch transformed(const affine& to_world) const {
+            mat4 px, py, pz;
+            for (int i = 0; i < 4; ++i) {
+                for (int j = 0; j < 4; ++j) {
+                    vec3 p = to_world.point(cp[i][j]);
+                    px[i][j] = p.x;
+                    py[i][j] = p.y;
+                    pz[i][j] = p.z;
+                }
+            }
+            return bezier_patch(px, py, pz);
+        }
+
         vec3 at(float u, float v) const {
             vec4 uvec(u*u*u, u*u, u, 1.0f);
             vec4 vvec(v*v*v, v*v, v, 1.0f);
@@ -83,26 +133,138 @@ class bezier_patch {
             vec4 uvec(u*u*u, u*u, u, 1.0f);
             vec4 vvec(v*v*v, v*v, v, 1.0f);
             vec4 duvec(3.0f * u * u, 2.0f * u, 1.0f, 0.0f);
-            vec4 dvvec(3.0f * u * u, 2.0f * u, 1.0f, 0.0f);
+            vec4 dvvec(3.0f * v * v, 2.0f * v, 1.0f, 0.0f);
             vec3 du(dot(vvec, x * duvec), dot(vvec, y * duvec), dot(vvec, z * duvec));
             vec3 dv(dot(dvvec, x * uvec), dot(dvvec, y * uvec), dot(dvvec, z * uvec));
             return cross(du, dv).dir();
         }
 
+        // Box around the piece of the patch over [u0, u1] x [v0, v1], from the convex hull of
+        // that piece's own control points
+        bbox bounds(float u0, float u1, float v0, float v1) const {
+            vec3 rows[4][4];
+            for (int i = 0; i < 4; ++i) {
+                rows[i][0] = blossom(cp[i], u0, u0, u0);
+                rows[i][1] = blossom(cp[i], u0, u0, u1);
+                rows[i][2] = blossom(cp[i], u0, u1, u1);
+                rows[i][3] = blossom(cp[i], u1, u1, u1);
+            }
+
+            vec3 lo(infinity), hi(-infinity);
+            for (int j = 0; j < 4; ++j) {
+                vec3 column[4] = {rows[0][j], rows[1][j], rows[2][j], rows[3][j]};
+                vec3 piece[4] = {blossom(column, v0, v0, v0), blossom(column, v0, v0, v1),
+                                 blossom(column, v0, v1, v1), blossom(column, v1, v1, v1)};
+                for (const vec3& p : piece) {
+                    lo = vec3(std::fmin(lo.x, p.x), std::fmin(lo.y, p.y), std::fmin(lo.z, p.z));
+                    hi = vec3(std::fmax(hi.x, p.x), std::fmax(hi.y, p.y), std::fmax(hi.z, p.z));
+                }
+            }
+            return bbox(lo, hi);
+        }
+
+        // Polynomial coefficients of dot(n, at(u, v)), used as vvec . (m * uvec)
+        mat4 project(const vec3& n) const {
+            return n.x * x + n.y * y + n.z * z;
+        }
+
+        // Grid of (div + 1)^2 surface points, point j + i * (div + 1) at (i / div, j / div). Row i
+        // is a cubic in v, walked with forward differences (kept in double so the error doesn't
+        // build up along the row) instead of a full at() per point, and the rows are shared out
+        // over the thread pool.
         std::vector<vec3> split(int div) const {
-            std::vector<vec3> pts;
-            pts.reserve((div + 1) * (div + 1));
-            
-            for (float i = 0.0f; i < div + 1; ++i) {
-                for (float j = 0.0f; j < div + 1; ++j) {
-                    pts.push_back(at(i / div, j / div));   
+            std::vector<vec3> pts((div + 1) * (div + 1));
+            double h = 1.0 / div;
+
+            thread_pool::global().parallel_for(div + 1, [&](int i) {
+                float u = float(i) / div;
+                vec4 uvec(u*u*u, u*u, u, 1.0f);
+                vec4 coeffs[3] = {x * uvec, y * uvec, z * uvec};  // of v^3, v^2, v and 1
+
+                double f[3], d1[3], d2[3], d3[3];
+                for (int a = 0; a < 3; ++a) {
+                    double c3 = coeffs[a][0] * h * h * h, c2 = coeffs[a][1] * h * h, c1 = coeffs[a][2] * h;
+                    f[a] = coeffs[a][3];
+                    d1[a] = c3 + c2 + c1;
+                    d2[a] = 6.0 * c3 + 2.0 * c2;
+                    d3[a] = 6.0 * c3;
+                }
+
+                vec3* row = &pts[i * (div + 1)];
+                for (int j = 0; j <= div; ++j) {
+                    row[j] = vec3(float(f[0]), float(f[1]), float(f[2]));
+                    for (int a = 0; a < 3; ++a) {
+                        f[a] += d1[a];
+                        d1[a] += d2[a];
+                        d2[a] += d3[a];
+                    }
+                }
+            });
+
+            return pts;
+        }
+
+        // split(div) through a file in cache_dir named after a hash of the control points and
+        // div, so a later run with the same patch reads the points back instead. The file also
+        // holds the control points, which are compared on load to rule out hash collisions.
+        // Only the x, y and z of each point are hashed and stored, so the file doesn't depend on
+        // how vec3 is laid out.
+        std::vector<vec3> cached_split(int div, const std::string& cache_dir) const {
+            float key[48];
+            for (int k = 0; k < 16; ++k)
+                for (int a = 0; a < 3; ++a) key[3 * k + a] = cp[k / 4][k % 4][a];
+
+            std::uint64_t hash = 14695981039346656037ull;  // FNV-1a
+            auto mix = [&](const void* data, size_t size) {
+                const unsigned char* bytes = static_cast<const unsigned char*>(data);
+                for (size_t k = 0; k < size; ++k) hash = (hash ^ bytes[k]) * 1099511628211ull;
+            };
+            mix(key, sizeof(key));
+            mix(&div, sizeof(div));
+
+            char name[64];
+            std::snprintf(name, sizeof(name), "bezier_%016llx_%d.bin", (unsigned long long)hash, div);
+            std::filesystem::path file = std::filesystem::path(cache_dir) / name;
+
+            size_t count = size_t(div + 1) * (div + 1);
+            std::vector<float> coords(3 * count);
+            std::ifstream in(file, std::ios::binary);
+            if (in) {
+                float stored[48];
+                in.read(reinterpret_cast<char*>(stored), sizeof(stored));
+                in.read(reinterpret_cast<char*>(coords.data()), coords.size() * sizeof(float));
+                if (in && std::memcmp(stored, key, sizeof(key)) == 0) {
+                    std::vector<vec3> pts(count);
+                    for (size_t k = 0; k < count; ++k) pts[k] = vec3(coords[3 * k], coords[3 * k + 1], coords[3 * k + 2]);
+                    return pts;
                 }
             }
 
+            std::vector<vec3> pts = split(div);
+            for (size_t k = 0; k < count; ++k)
+                for (int a = 0; a < 3; ++a) coords[3 * k + a] = pts[k][a];
+
+            // Written next to the cache and renamed over it, so another run never reads a file
+            // that is only partly written
+            std::error_code error;
+            std::filesystem::create_directories(cache_dir, error);
+            std::filesystem::path temp = file;
+            temp += ".tmp";
+            std::ofstream out(temp, std::ios::binary);
+            out.write(reinterpret_cast<const char*>(key), sizeof(key));
+            out.write(reinterpret_cast<const char*>(coords.data()), coords.size() * sizeof(float));
+            out.close();
+            if (out) std::filesystem::rename(temp, file, error);
+            if (!out || error) {
+                std::filesystem::remove(temp, error);
+                std::cerr << "WARNING: could not write tesselation cache " << file.string() << '\n';
+            }
             return pts;
         }
 
-        hittable_list tesselate(int div, shared_ptr<material> mat) const {
+        // Bilinear patches over the split(div) grid, read from or saved to cache_dir unless
+        // it is empty
+        hittable_list tesselate(int div, shared_ptr<material> mat, const std::string& cache_dir = "") const {
             // hittable_list ret(div * div * 2);
 
             // std::vector<vec3> pt = split(div);
@@ -119,7 +281,7 @@ class bezier_patch {
 
             hittable_list ret(div * div);
 
-            std::vector<vec3> pt = split(div);
+            std::vector<vec3> pt = cache_dir.empty() ? split(div) : cached_split(div, cache_dir);
             for (int i = 0; i < div; ++i) {
                 for (int j = 0; j < div; ++j) {
                     vec3 p0 = pt[j + i * (div + 1)];
@@ -133,4 +295,179 @@ class bezier_patch {
         }
 };
 
+// Ray traces a bezier patch directly instead of through tesselate(). The (u, v) square is cut
+// into cells x cells pieces, each bounded by the hull of its own control points and put in a
+// small BVH. A ray that reaches a cell runs Newton's method from the cell's center on the two
+// planes that contain the ray, so the hit lies on the true surface with its true normal, and
+// the scene BVH sees the whole patch as one primitive.
+class bezier_surface : public hittable {
+    private:
+        bezier_patch surface;
+        shared_ptr<material> mat;
+        int cells;
+        std::vector<bvh_array_node> nodes;  // depth first, a leaf holds one cell index
+        bbox bound_box;
+        float tolerance;                    // plane distance at which Newton has converged
+
+        static const int max_iterations = 8;
+        static const int stack_size = 32;
+
+        // Cells [u0, u1) x [v0, v1) of the grid, split in half along the longer side
+        int build(int u0, int u1, int v0, int v1) {
+            int index = int(nodes.size());
+            nodes.emplace_back();
+
+            bbox box = surface.bounds(float(u0) / cells, float(u1) / cells, float(v0) / cells, float(v1) / cells);
+            for (int a = 0; a < 3; ++a) {
+                nodes[index].bmin[a] = box[a].min;
+                nodes[index].bmax[a] = box[a].max;
+            }
+
+            if (u1 - u0 == 1 && v1 - v0 == 1) {
+                nodes[index].offset = v0 * cells + u0;
+                nodes[index].count = 1;
+                nodes[index].axis = 0;
+                return index;
+            }
+
+            int axis = 0;
+            for (int a = 1; a < 3; ++a)
+                if (box[a].size() > box[axis].size()) axis = a;
+
+            nodes[index].count = 0;
+            nodes[index].axis = std::uint8_t(axis);
+            int right;
+            if (u1 - u0 >= v1 - v0) {
+                int mid = (u0 + u1) / 2;
+                build(u0, mid, v0, v1);
+                right = build(mid, u1, v0, v1);
+            } else {
+                int mid = (v0 + v1) / 2;
+                build(u0, u1, v0, mid);
+                right = build(u0, u1, mid, v1);
+            }
+            nodes[index].offset = right;
+            return index;
+        }
+
+        // Newton's method on F(u, v) = (f1(u, v), f2(u, v)), the signed distances of the patch
+        // point to the two ray planes, started from the center of the cell
+        bool solve(int cell, const mat4& f1, const mat4& f2, float& u, float& v) const {
+            float size = 1.0f / cells;
+            float u_lo = (cell % cells) * size, v_lo = (cell / cells) * size;
+            u = u_lo + 0.5f * size;
+            v = v_lo + 0.5f * size;
+
+            for (int k = 0; k < max_iterations; ++k) {
+                vec4 uvec(u*u*u, u*u, u, 1.0f);
+                vec4 vvec(v*v*v, v*v, v, 1.0f);
+                vec4 duvec(3.0f * u * u, 2.0f * u, 1.0f, 0.0f);
+                vec4 dvvec(3.0f * v * v, 2.0f * v, 1.0f, 0.0f);
+
+                vec4 a1 = f1 * uvec, b1 = f1 * duvec;
+                vec4 a2 = f2 * uvec, b2 = f2 * duvec;
+                float F1 = dot(vvec, a1), F2 = dot(vvec, a2);
+                if (std::fabs(F1) + std::fabs(F2) < tolerance) {
+                    return u >= 0.0f && u <= 1.0f && v >= 0.0f && v <= 1.0f;
+                }
+
+                float F1u = dot(vvec, b1), F1v = dot(dvvec, a1);
+                float F2u = dot(vvec, b2), F2v = dot(dvvec, a2);
+                float det = F1u * F2v - F1v * F2u;
+                if (std::fabs(det) < 1e-12f) return false;
+
+                u -= (F1 * F2v - F2 * F1v) / det;
+                v -= (F2 * F1u - F1 * F2u) / det;
+
+                // Left the neighbourhood of this cell, the neighbours cover that part
+                if (u < u_lo - size || u > u_lo + 2.0f * size || v < v_lo - size || v > v_lo + 2.0f * size)
+                    return false;
+            }
+            return false;
+        }
+
+    public:
+        bezier_surface(const bezier_patch& surface, shared_ptr<material> mat, int cells = 16) :
+            surface(surface), mat(mat), cells(cells)
+        {
+            nodes.reserve(2 * cells * cells);
+            build(0, cells, 0, cells);
+            const bvh_array_node& root = nodes[0];
+            bound_box = bbox(vec3(root.bmin[0], root.bmin[1], root.bmin[2]), vec3(root.bmax[0], root.bmax[1], root.bmax[2]));
+            tolerance = 1e-6f * std::fmax(bound_box[0].size(), std::fmax(bound_box[1].size(), bound_box[2].size()));
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            // The ray as the line where two planes through its origin meet
+            vec3 d = r.dir().dir();
+            vec3 n1 = std::fabs(d.x) > std::fabs(d.y) && std::fabs(d.x) > std::fabs(d.z) ?
+                      vec3(d.y, -d.x, 0.0f) : vec3(0.0f, d.z, -d.y);
+            n1 = n1.dir();
+            vec3 n2 = cross(n1, d);
+
+            mat4 f1 = surface.project(n1);
+            mat4 f2 = surface.project(n2);
+            f1[3][3] -= dot(n1, r.pt());
+            f2[3][3] -= dot(n2, r.pt());
+
+            const vec3& origin = r.pt();
+            vec3 inv_dir(1.0f / r.dir().x, 1.0f / r.dir().y, 1.0f / r.dir().z);
+            bool dir_neg[3] = { inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f };
+            float dir_length_sq = r.dir().length_squared();
+
+            int stack[stack_size];
+            int top = 0;
+            int index = 0;
+            bool hit_anything = false;
+            float hit_u = 0.0f, hit_v = 0.0f;
+
+            while (true) {
+                const bvh_array_node& node = nodes[index];
+                RT_STAT(bvh_nodes);
+                if (node.hit(origin, inv_dir, ray_t)) {
+                    if (node.count > 0) {
+                        float u, v;
+                        RT_STAT(bezier_cell_tests);
+                        if (solve(node.offset, f1, f2, u, v)) {
+                            float t = dot(surface.at(u, v) - origin, r.dir()) / dir_length_sq;
+                            if (ray_t.surrounds(t)) {
+                                ray_t.max = t;
+                                hit_u = u;
+                                hit_v = v;
+                                hit_anything = true;
+                            }
+                        }
+                    } else {
+                        if (dir_neg[node.axis]) {
+                            stack[top++] = index + 1;
+                            index = node.offset;
+                        } else {
+                            stack[top++] = node.offset;
+                            index = index + 1;
+                        }
+                        continue;
+                    }
+                }
+                if (top == 0) break;
+                index = stack[--top];
+            }
+
+            if (!hit_anything) return false;
+
+            rec.t = ray_t.max;
+            rec.pt = r.at(rec.t);
+            rec.normal = -surface.normal(hit_u, hit_v);  // faces the same way as the tesselate() patches
+            rec.u = hit_u;
+            rec.v = hit_v;
+            rec.mat = mat.get();
+            return true;
+        }
+
+        bbox bounding_box() const override { return bound_box; }
+
+        shared_ptr<hittable> transformed(const affine& to_world) const override {
+            return make_shared<bezier_surface>(surface.transformed(to_world), mat, cells);
+        }
+};
+
 #endif
\ No newline at end of file
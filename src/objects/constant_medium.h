@@ -5,12 +5,25 @@
 #include "material.h"
 #include "texture.h"
 
+#include <cstring>
+
 class constant_medium : public hittable {
     private:
         shared_ptr<hittable> boundary;
         float neg_inv_density;
         shared_ptr<material> phase_function;
 
+        static std::uint64_t ray_seed(const ray& r) {
+            // hit() has no sampler, so the free-flight distance comes from a stream keyed on
+            // the ray itself. Same ray, same distance, whichever thread traces it.
+            std::uint32_t bits[7];
+            float f[7] = {r.pt().x, r.pt().y, r.pt().z, r.dir().x, r.dir().y, r.dir().z, r.time()};
+            std::memcpy(bits, f, sizeof(bits));
+            std::uint64_t h = 0;
+            for (std::uint32_t b : bits) h = sampler::hash(h, b);
+            return h;
+        }
+
     public:
         constant_medium(shared_ptr<hittable> boundary, float density, shared_ptr<texture> tex) :
             boundary(boundary), neg_inv_density(-1.0f / density), phase_function(make_shared<isotropic>(tex))
@@ -22,6 +35,7 @@ class constant_medium : public hittable {
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
             hit_record rec1, rec2;
+            RT_STAT(medium_tests);
 
             if (!boundary->hit(r, interval::universe, rec1)) return false;
             if (!boundary->hit(r, interval(rec1.t + .0001f, infinity), rec2)) return false;
@@ -35,7 +49,8 @@ class constant_medium : public hittable {
 
             float ray_length = r.dir().length();
             float dist_inside = (rec2.t - rec1.t) * ray_length;
-            float hit_dist = neg_inv_density * std::log(random_float());
+            sampler rng(ray_seed(r));
+            float hit_dist = neg_inv_density * std::log(rng.next_float());
 
             if (hit_dist > dist_inside) return false;
 
@@ -43,12 +58,26 @@ class constant_medium : public hittable {
             rec.pt = r.at(rec.t);
 
             rec.normal = vec3(1.0f, 0.0f, 0.0f); //arbitrary
-            rec.mat = phase_function;
+            rec.mat = phase_function.get();
 
             return true;
         }
 
         bbox bounding_box() const override { return boundary->bounding_box(); }
+
+        const shared_ptr<hittable>& boundary_object() const { return boundary; }
+
+        // The same medium inside another boundary
+        shared_ptr<constant_medium> with_boundary(shared_ptr<hittable> object) const {
+            auto medium = make_shared<constant_medium>(*this);
+            medium->boundary = object;
+            return medium;
+        }
+
+        shared_ptr<hittable> transformed(const affine& to_world) const override {
+            shared_ptr<hittable> moved = boundary->transformed(to_world);
+            return moved ? with_boundary(moved) : nullptr;
+        }
 };
 
 #endif
\ No newline at end of file
@@ -2,15 +2,17 @@
 #define HITTABLE_H
 
 #include "../math/ray.h"
+#include "../math/ray_packet.h"
 #include "../utility/bbox.h"
 
 class material;
+class affine;
 
 class hit_record {
     public:
         vec3 pt;
         vec3 normal;
-        shared_ptr<material> mat;
+        const material* mat;    // non-owning, the primitive that was hit keeps its material alive
         float t;
         float u;
         float v;
@@ -24,15 +26,38 @@ class hittable {
 
     virtual bbox bounding_box() const = 0;
 
+    // Intersects the lanes of mask with this object, for lanes that hit closer than their tmax:
+    // lowers tmax, stores the primitive that was hit in hit[k] and sets bit k of the result.
+    // Only t is found, the caller gets the full record from hit[k]->hit() afterwards. The default
+    // traces the lanes one at a time.
+    virtual int hit_packet(ray_packet& p, int mask, const hittable** hit) const {
+        int hits = 0;
+        hit_record rec;
+        for (int k = 0; k < ray_packet::size; ++k) {
+            if (!(mask & (1 << k))) continue;
+            if (this->hit(p.lane(k), interval(p.tmin, p.tmax[k]), rec)) {
+                p.tmax[k] = rec.t;
+                hit[k] = this;
+                hits |= 1 << k;
+            }
+        }
+        return hits;
+    }
+
     virtual bool empty() const { return true; }
 
     virtual float pdf_value(const vec3& origin, const vec3& direction) const {
         return 0.0f;
     }
 
-    virtual vec3 random(const vec3& origin) const {
+    virtual vec3 random(const vec3& origin, sampler& rng) const {
         return vec3(1.0f, 0.0f, 0.0f);
     }
+
+    // A copy of this object with its geometry moved by to_world, which must not mirror. Used to
+    // bake transforms into primitives when a scene is built, see utility/transform_baker.h.
+    // nullptr if the object can't be moved exactly, it then stays behind its transform.
+    virtual shared_ptr<hittable> transformed(const affine& to_world) const { return nullptr; }
 };
 
 #endif
\ No newline at end of file
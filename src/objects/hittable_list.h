@@ -32,21 +32,28 @@ class hittable_list : public hittable {
         }
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-            hit_record temp_rec;
+            // Objects only write rec when they report a hit inside the interval, so each one
+            // can write straight into it as the interval shrinks
             bool hit_anything = false;
             float closest = ray_t.max;
             
             for (const auto& object : objects) {
-                if (object->hit(r, interval(ray_t.min, closest), temp_rec)) {
+                if (object->hit(r, interval(ray_t.min, closest), rec)) {
                     hit_anything = true;
-                    closest = temp_rec.t;
-                    rec = temp_rec;
+                    closest = rec.t;
                 }
             }
 
             return hit_anything;
         }
 
+        int hit_packet(ray_packet& p, int mask, const hittable** hit) const override {
+            int hits = 0;
+            for (const auto& object : objects)
+                hits |= object->hit_packet(p, mask, hit);
+            return hits;
+        }
+
         bool empty() const { return objects.empty(); }
 
         bbox bounding_box() const override { return bound_box; }
@@ -60,9 +67,19 @@ class hittable_list : public hittable {
             return pdf_value / objects.size();
         }
 
-        vec3 random(const vec3& origin) const override{
-            if (objects.empty()) return random_unit_vector();
-            return objects[random_int(0, objects.size())]->random(origin);
+        vec3 random(const vec3& origin, sampler& rng) const override{
+            if (objects.empty()) return random_unit_vector(rng);
+            return objects[rng.next_int(0, objects.size())]->random(origin, rng);
+        }
+
+        shared_ptr<hittable> transformed(const affine& to_world) const override {
+            auto moved = make_shared<hittable_list>(int(objects.size()));
+            for (const auto& object : objects) {
+                shared_ptr<hittable> m = object->transformed(to_world);
+                if (!m) return nullptr;
+                moved->add(m);
+            }
+            return moved;
         }
 };
 
@@ -0,0 +1,60 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "hittable.h"
+#include "../math/affine.h"
+
+// One placement of a shared object, usually a bottom level BVH built once for an asset such as a
+// mesh or a box, under an affine transform. Any number of instances share the object, so a
+// thousand copies cost one copy of the geometry plus a pair of matrices each, and the BVH above
+// the instances only has to be rebuilt over their boxes when they move. The object to world
+// transform is kept next to its inverse so a hit costs matrix products, not quaternion ones.
+class instance : public hittable {
+    private:
+        shared_ptr<hittable> object;
+        affine to_world;
+        affine to_object;
+        bbox bound_box;
+
+    public:
+        instance(shared_ptr<hittable> object, const affine& to_world) :
+            object(object), to_world(to_world), to_object(to_world.inverse())
+        {
+            // Bounds of the eight transformed corners of the object's box
+            bbox box = object->bounding_box();
+            vec3 min(infinity), max(-infinity);
+            for (int i = 0; i < 2; ++i) {
+                for (int j = 0; j < 2; ++j) {
+                    for (int k = 0; k < 2; ++k) {
+                        vec3 corner = to_world.point(vec3(i ? box[0].max : box[0].min,
+                                                          j ? box[1].max : box[1].min,
+                                                          k ? box[2].max : box[2].min));
+                        for (int a = 0; a < 3; ++a) {
+                            min[a] = std::fmin(min[a], corner[a]);
+                            max[a] = std::fmax(max[a], corner[a]);
+                        }
+                    }
+                }
+            }
+            bound_box = bbox(min, max);
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            if (!object->hit(to_object.transform(r), ray_t, rec)) return false;
+
+            rec.pt = r.at(rec.t);
+            rec.normal = to_object.transposed(rec.normal).dir();
+            return true;
+        }
+
+        bbox bounding_box() const override { return bound_box; }
+
+        const shared_ptr<hittable>& shared_object() const { return object; }
+
+        // Moving an instance moves its placement, the shared object stays as it is
+        shared_ptr<hittable> transformed(const affine& outer) const override {
+            return make_shared<instance>(object, outer * to_world);
+        }
+};
+
+#endif
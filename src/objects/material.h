@@ -5,11 +5,19 @@
 #include "texture.h"
 #include "../math/pdf.h"
 
+#include <variant>
+
 struct scatter_record {
     vec3 attenuation;
-    shared_ptr<pdf> pdf_ptr;
+    std::variant<std::monostate, cosine_pdf, sphere_pdf> scatter_pdf; // stored inline, no allocation per bounce
     bool skip_pdf;
     ray skip_pdf_ray;
+
+    const pdf* pdf_ptr() const {
+        if (auto p = std::get_if<cosine_pdf>(&scatter_pdf)) return p;
+        if (auto p = std::get_if<sphere_pdf>(&scatter_pdf)) return p;
+        return nullptr;
+    }
 };
 
 class material {
@@ -20,7 +28,9 @@ class material {
             return vec3();
         }
 
-        virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const {
+        // Lights and anything else that only absorbs
+        virtual bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec, sampler& rng) const {
+            RT_STAT(emissive_scatters);
             return false;
         }
 
@@ -37,9 +47,10 @@ class lambertian : public material {
         lambertian(const vec3& albedo) : tex(make_shared<solid_color>(albedo)) {}
         lambertian(shared_ptr<texture> tex) : tex(tex) {}
 
-        bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
+        bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec, sampler& rng) const override {
+            RT_STAT(lambertian_scatters);
             srec.attenuation = tex->value(rec.u, rec.v, rec.pt);
-            srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
+            srec.scatter_pdf = cosine_pdf(rec.normal);
             srec.skip_pdf = false;
             return true;
         }
@@ -58,12 +69,13 @@ class metal : public material {
     public:
         metal(const vec3& albedo, float fuzz = 0.0f) : albedo(albedo), fuzz(fuzz) {}
 
-        bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
+        bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec, sampler& rng) const override {
+            RT_STAT(metal_scatters);
             vec3 reflected = reflect(r_in.dir(), rec.normal);
-            reflected = reflected.dir() + fuzz * random_unit_vector();
+            reflected = reflected.dir() + fuzz * random_unit_vector(rng);
 
             srec.attenuation = albedo;
-            srec.pdf_ptr = nullptr;
+            srec.scatter_pdf = std::monostate();
             srec.skip_pdf = true;
             srec.skip_pdf_ray = ray(rec.pt, reflected, r_in.time());
             
@@ -90,9 +102,10 @@ class dielectric : public material {
         dielectric(float refract_index) :
                    albedo(1), refract_index(refract_index) {}
         
-        bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
+        bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec, sampler& rng) const override {
+            RT_STAT(dielectric_scatters);
             srec.attenuation = albedo;
-            srec.pdf_ptr = nullptr;
+            srec.scatter_pdf = std::monostate();
             srec.skip_pdf = true;
 
             vec3 normal = rec.normal;
@@ -109,7 +122,7 @@ class dielectric : public material {
             bool cannot_refract = ri * sin > 1.0;
             vec3 direction;
             vec3 position;
-            if (cannot_refract || reflectance(cos, ri) > random_float()) {
+            if (cannot_refract || reflectance(cos, ri) > rng.next_float()) {
                  direction = reflect(unit_dir, normal);
                  position = rec.pt + 0.001f * normal;
             }
@@ -145,9 +158,10 @@ class isotropic : public material {
         isotropic(const vec3& albedo) : tex(make_shared<solid_color>(albedo)) {}
         isotropic(shared_ptr<texture> tex) : tex(tex) {}
 
-        bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override{
+        bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec, sampler& rng) const override{
+            RT_STAT(isotropic_scatters);
             srec.attenuation = tex->value(rec.u, rec.v, rec.pt);
-            srec.pdf_ptr = make_shared<sphere_pdf>();
+            srec.scatter_pdf = sphere_pdf();
             srec.skip_pdf = false;
             return true;
         }
@@ -0,0 +1,261 @@
+#ifndef PACKED_PRIMITIVES_H
+#define PACKED_PRIMITIVES_H
+
+#include "hittable.h"
+#include "sphere.h"
+#include "quad.h"
+#include "../math/triangle_intersect.h"
+#include "../utility/bvh.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// A static sphere, quad or triangle as plain data, the same shape the sphere, quad and triangle
+// classes build. It holds no pointers, so arrays of them can be written to a file and used
+// straight from memory mapped back in.
+struct packed_primitive {
+    enum kind_type : std::uint32_t { sphere_kind, quad_kind, triangle_kind };
+
+    float p[9];                 // sphere: center, radius; quad: Q, u, v; triangle: p0, p1, p2
+    std::uint32_t kind;
+    std::uint32_t material;     // index into the material table of the packed_primitives
+
+    vec3 point(int k) const { return vec3(p[3 * k], p[3 * k + 1], p[3 * k + 2]); }
+
+    // Same box the matching class computes
+    bbox bounds() const {
+        if (kind == sphere_kind) return bbox(point(0) - p[3], point(0) + p[3]);
+        if (kind == quad_kind) {
+            vec3 Q = point(0), u = point(1), v = point(2);
+            return bbox(bbox(Q, Q + u + v), bbox(Q + u, Q + v));
+        }
+        vec3 Q = point(0);
+        return bbox(bbox(Q, point(1)), bbox(Q, point(2)));
+    }
+};
+
+static_assert(sizeof(packed_primitive) == 44, "packed_primitive is stored as is in scene caches");
+
+// Many static spheres, quads and triangles in one array with one BVH over it, like
+// triangle_mesh does for triangles, instead of a heap allocated object each. The arrays are
+// either owned or borrowed from memory that owner keeps alive, e.g. a mapped scene cache.
+class packed_primitives : public hittable {
+    private:
+        std::vector<bvh_array_node> node_storage;
+        std::vector<packed_primitive> prim_storage;
+        std::shared_ptr<const void> owner;
+        const bvh_array_node* nodes = nullptr;
+        size_t node_count = 0;
+        const packed_primitive* prims = nullptr;  // in leaf order
+        size_t prim_count = 0;
+        std::vector<shared_ptr<material>> materials;
+        bbox bound_box;
+
+        static const int max_leaf_size = 4;
+        static const int stack_size = bvh_node::max_depth;  // one entry per level at most
+
+        void set_bbox() {
+            if (node_count == 0) return;
+            const bvh_array_node& root = nodes[0];
+            bound_box = bbox(vec3(root.bmin[0], root.bmin[1], root.bmin[2]), vec3(root.bmax[0], root.bmax[1], root.bmax[2]));
+        }
+
+        // Same tests as sphere::hit, quad::hit and triangle::hit
+        bool hit_sphere(const packed_primitive& s, const ray& r, const interval& ray_t, hit_record& rec) const {
+            RT_STAT(sphere_tests);
+            vec3 center = s.point(0);
+            float radius = std::fmax(0.0f, s.p[3]);
+            vec3 oc = center - r.pt();
+            float a = r.dir().length_squared();
+            float h = dot(r.dir(), oc);
+            float c = oc.length_squared() - radius * radius;
+
+            float discriminant = h * h - a * c;
+            if (discriminant < 0.0f) return false;
+
+            float sqrtd = std::sqrt(discriminant);
+            float root = (h - sqrtd) / a;
+            if (!ray_t.surrounds(root)) {
+                root = (h + sqrtd) / a;
+                if (!ray_t.surrounds(root)) return false;
+            }
+
+            rec.t = root;
+            rec.pt = r.at(root);
+            rec.normal = (rec.pt - center) / radius;
+            rec.mat = materials[s.material].get();
+            sphere::get_sphere_uv(rec.normal, rec.u, rec.v);
+            return true;
+        }
+
+        bool hit_quad(const packed_primitive& q, const ray& r, const interval& ray_t, hit_record& rec) const {
+            RT_STAT(quad_tests);
+            vec3 Q = q.point(0), u = q.point(1), v = q.point(2);
+            float det = quad::determinant(-r.dir(), u, v);
+            if (std::fabs(det) < 1e-8) return false;
+
+            vec3 OQ = r.pt() - Q;
+            float a = quad::determinant(-r.dir(), OQ, v) / det;
+            float b = quad::determinant(-r.dir(), u, OQ) / det;
+
+            interval i(0.0f, 1.0f);
+            if (!i.contains(a) || !i.contains(b)) return false;
+
+            float t = quad::determinant(OQ, u, v) / det;
+            if (!ray_t.contains(t)) return false;
+
+            rec.t = t;
+            rec.pt = r.at(t);
+            rec.mat = materials[q.material].get();
+            rec.normal = cross(u, v).dir();
+            rec.u = a;
+            rec.v = b;
+            return true;
+        }
+
+        bool hit_triangle(const packed_primitive& tri, const ray& r, const interval& ray_t,
+                          hit_record& rec) const {
+            RT_STAT(triangle_tests);
+            vec3 Q = tri.point(0), R = tri.point(1), S = tri.point(2);
+            float t, a, b;
+            if (!intersect_triangle(r, Q, R, S, ray_t, t, a, b)) return false;
+
+            rec.t = t;
+            rec.pt = r.at(t);
+            rec.mat = materials[tri.material].get();
+            rec.normal = cross(R - Q, S - Q).dir();
+            rec.u = a;
+            rec.v = b;
+            return true;
+        }
+
+    public:
+        // Builds the BVH over prims, whose material fields index materials
+        packed_primitives(std::vector<packed_primitive> data, std::vector<shared_ptr<material>> materials) :
+            materials(std::move(materials))
+        {
+            size_t count = data.size();
+            std::vector<bvh_build_box> boxes(count);
+            std::vector<std::uint32_t> order(count);
+            for (size_t k = 0; k < count; ++k) {
+                bbox box = data[k].bounds();
+                for (int a = 0; a < 3; ++a) {
+                    boxes[k].bmin[a] = box[a].min;
+                    boxes[k].bmax[a] = box[a].max;
+                    boxes[k].centroid[a] = 0.5f * (box[a].min + box[a].max);
+                }
+                order[k] = std::uint32_t(k);
+            }
+
+            if (count > 0) {
+                node_storage.reserve(count / 2 + 1);
+                build_flat_bvh(node_storage, boxes, order, max_leaf_size);
+                node_storage.shrink_to_fit();
+            }
+
+            // Store the primitives in leaf order so a leaf reads one run of the array
+            prim_storage.reserve(count);
+            for (std::uint32_t k : order) prim_storage.push_back(data[k]);
+
+            nodes = node_storage.data();
+            node_count = node_storage.size();
+            prims = prim_storage.data();
+            prim_count = prim_storage.size();
+            set_bbox();
+        }
+
+        // Uses a tree and primitives saved from node_data() and prim_data() in place. hit() trusts
+        // every index in them, so arrays read from a file must pass valid() first.
+        packed_primitives(const bvh_array_node* nodes, size_t node_count, const packed_primitive* prims, size_t prim_count,
+                          std::vector<shared_ptr<material>> materials, std::shared_ptr<const void> owner) :
+            owner(std::move(owner)), nodes(nodes), node_count(node_count), prims(prims), prim_count(prim_count),
+            materials(std::move(materials))
+        {
+            set_bbox();
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            if (node_count == 0) return false;
+
+            const vec3& origin = r.pt();
+            vec3 inv_dir(1.0f / r.dir().x, 1.0f / r.dir().y, 1.0f / r.dir().z);
+            bool dir_neg[3] = { inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f };
+
+            int stack[stack_size];
+            int top = 0;
+            int index = 0;
+            bool hit_anything = false;
+
+            while (true) {
+                const bvh_array_node& node = nodes[index];
+                RT_STAT(bvh_nodes);
+                if (node.hit(origin, inv_dir, ray_t)) {
+                    if (node.count > 0) {
+                        for (int i = node.offset; i < node.offset + node.count; ++i) {
+                            const packed_primitive& prim = prims[i];
+                            bool found;
+                            if (prim.kind == packed_primitive::sphere_kind) {
+                                found = hit_sphere(prim, r, ray_t, rec);
+                            } else if (prim.kind == packed_primitive::quad_kind) {
+                                found = hit_quad(prim, r, ray_t, rec);
+                            } else {
+                                found = hit_triangle(prim, r, ray_t, rec);
+                            }
+                            if (found) {
+                                hit_anything = true;
+                                ray_t.max = rec.t;
+                            }
+                        }
+                    } else {
+                        if (dir_neg[node.axis]) {
+                            stack[top++] = index + 1;
+                            index = node.offset;
+                        } else {
+                            stack[top++] = node.offset;
+                            index = index + 1;
+                        }
+                        continue;
+                    }
+                }
+                if (top == 0) break;
+                index = stack[--top];
+            }
+
+            return hit_anything;
+        }
+
+        bbox bounding_box() const override { return bound_box; }
+
+        // True if the tree only points forward, inside the node array and no deeper than the
+        // traversal stack, its leaves stay inside the primitive array, and every primitive has
+        // a known kind and a material below material_count
+        static bool valid(const bvh_array_node* nodes, size_t node_count, const packed_primitive* prims, size_t prim_count,
+                          size_t material_count) {
+            std::vector<int> depth(node_count, 0);
+            for (size_t k = 0; k < node_count; ++k) {
+                const bvh_array_node& node = nodes[k];
+                if (node.count > 0) {
+                    if (node.offset < 0 || size_t(node.offset) + node.count > prim_count) return false;
+                    continue;
+                }
+                size_t second = size_t(std::uint32_t(node.offset));
+                if (node.offset < 0 || second <= k + 1 || second >= node_count || node.axis > 2) return false;
+                if (depth[k] + 1 >= stack_size) return false;
+                depth[k + 1] = std::max(depth[k + 1], depth[k] + 1);
+                depth[second] = std::max(depth[second], depth[k] + 1);
+            }
+            for (size_t k = 0; k < prim_count; ++k)
+                if (prims[k].kind > packed_primitive::triangle_kind || prims[k].material >= material_count) return false;
+            return true;
+        }
+
+        size_t material_count() const { return materials.size(); }
+
+        const bvh_array_node* node_data() const { return nodes; }
+        size_t nodes_size() const { return node_count; }
+        const packed_primitive* prim_data() const { return prims; }
+        size_t size() const { return prim_count; }
+};
+
+#endif
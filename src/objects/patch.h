@@ -2,15 +2,11 @@
 #define PATCH_H
 
 #include "hittable.h"
+#include "../math/affine.h"
 
 class patch : public hittable{
     private:
-        union {
-            vec3 pts[4];
-            struct {
-                vec3 p0, p1, p2, p3;
-            };
-        };
+        vec3 p0, p1, p2, p3;
 
         shared_ptr<material> mat;
         bbox bound_box;
@@ -60,7 +56,7 @@ class patch : public hittable{
             rec.t = t;
             rec.u = u;
             rec.v = v;
-            rec.mat = mat;
+            rec.mat = mat.get();
             return true;
         }
 
@@ -71,6 +67,7 @@ class patch : public hittable{
               bound_box(bbox(p0, p1), bbox(p2, p3)) {}
         
         bool hit(const ray& r, interval ray_t, hit_record& rec) const {
+                RT_STAT(patch_tests);
                 vec3 a = p3 - p2 - p1 + p0;
                 vec3 b = p2 - p0;
                 vec3 c = p1 - p0;
@@ -99,29 +96,21 @@ class patch : public hittable{
                     return solve(o, q, v, A1, B1, C1, D1, A2, B2, C2, D2, ray_t, rec);
                 }
                 float sqrt_disc = std::sqrt(disc);
-                hit_record r1, r2;
-                float v1 = (-B - sqrt(disc)) / (2.0f * A);
-                float v2 = (-B + sqrt(disc)) / (2.0f * A);
-                bool b1 = solve(o, q, v1, A1, B1, C1, D1, A2, B2, C2, D2, ray_t, r1);
-                if (!b1) {
-                    return solve(o, q, v2, A1, B1, C1, D1, A2, B2, C2, D2, ray_t, rec);
-                } else {
-                    bool b2 = solve(o, q, v2, A1, B1, C1, D1, A2, B2, C2, D2, ray_t, r2);
-                    if (!b2) {
-                        rec = r1;
-                        return true;
-                    }
-                    if (r1.t < r2.t) {
-                        rec = r1;
-                        return true;
-                    }
-                    rec = r2;
-                    return true;
-                }
+                float v1 = (-B - sqrt_disc) / (2.0f * A);
+                float v2 = (-B + sqrt_disc) / (2.0f * A);
+                // solve() only writes rec on a hit, so the second root only replaces the first
+                // when it is closer
+                bool b1 = solve(o, q, v1, A1, B1, C1, D1, A2, B2, C2, D2, ray_t, rec);
+                if (b1) ray_t.max = rec.t;
+                bool b2 = solve(o, q, v2, A1, B1, C1, D1, A2, B2, C2, D2, ray_t, rec);
+                return b1 || b2;
         }
 
         bbox bounding_box() const { return bound_box; }
-        
+
+        shared_ptr<hittable> transformed(const affine& to_world) const {
+            return make_shared<patch>(to_world.point(p0), to_world.point(p1), to_world.point(p2), to_world.point(p3), mat);
+        }
 };
 
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 #define QUAD_H
 
 #include "hittable.h"
+#include "../math/affine.h"
 
 class quad : public hittable {
     private:
@@ -12,11 +13,6 @@ class quad : public hittable {
         vec3 n;
         float area;
 
-        static float determinant(vec3 c1, vec3 c2, vec3 c3) {
-            vec3 ray_cross = cross(c3, c1);
-            return dot(c2, ray_cross);
-        }
-
         void set_bbox() {
             bbox box_diagonal1 = bbox(Q, Q + u + v);
             bbox box_diagonal2 = bbox(Q + u, Q + v);
@@ -24,6 +20,11 @@ class quad : public hittable {
         }
 
     public:
+        static float determinant(vec3 c1, vec3 c2, vec3 c3) {
+            vec3 ray_cross = cross(c3, c1);
+            return dot(c2, ray_cross);
+        }
+
         quad(const vec3& Q, const vec3& u, const vec3& v, shared_ptr<material> mat) :
             Q(Q), u(u), v(v), mat(mat)
         {
@@ -35,6 +36,7 @@ class quad : public hittable {
         bbox bounding_box() const override { return bound_box; }
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            RT_STAT(quad_tests);
             // using Cramer's rule to determine hits
             float det = determinant(-r.dir(), u, v);
             if (std::fabs(det) < 1e-8) return false;
@@ -58,7 +60,7 @@ class quad : public hittable {
 
             rec.t = t;
             rec.pt = P;
-            rec.mat = mat;
+            rec.mat = mat.get();
             rec.normal = n.dir();
             rec.u = a;
             rec.v = b;
@@ -66,6 +68,23 @@ class quad : public hittable {
             return true;
         }
 
+        int hit_packet(ray_packet& p, int mask, const hittable** hit) const override {
+            RT_STAT_ADD(quad_tests, render_stats::lanes(mask));
+            alignas(32) float det[ray_packet::size], a[ray_packet::size], b[ray_packet::size], t[ray_packet::size];
+            p.solve_planar(Q, u, v, det, a, b, t);
+
+            int hits = 0;
+            for (int k = 0; k < ray_packet::size; ++k) {
+                bool inside = a[k] >= 0.0f && a[k] <= 1.0f && b[k] >= 0.0f && b[k] <= 1.0f;
+                bool in_range = t[k] >= p.tmin && t[k] <= p.tmax[k];
+                if (!(mask & (1 << k)) || std::fabs(det[k]) < 1e-8 || !inside || !in_range) continue;
+                p.tmax[k] = t[k];
+                hit[k] = this;
+                hits |= 1 << k;
+            }
+            return hits;
+        }
+
         float pdf_value(const vec3& origin, const vec3& direction) const override {
             hit_record rec;
             if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec)) return 0.0f;
@@ -76,8 +95,12 @@ class quad : public hittable {
             return dist_sq / (cos * area);
         }
 
-        vec3 random(const vec3& origin) const override {
-            return Q + (random_float() * u) + (random_float() * v) - origin;
+        vec3 random(const vec3& origin, sampler& rng) const override {
+            return Q + (rng.next_float() * u) + (rng.next_float() * v) - origin;
+        }
+
+        shared_ptr<hittable> transformed(const affine& to_world) const override {
+            return make_shared<quad>(to_world.point(Q), to_world.vector(u), to_world.vector(v), mat);
         }
 };
 
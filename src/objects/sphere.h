@@ -2,6 +2,7 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "../math/affine.h"
 #include "../math/onb.h"
 #include "../raytracer.h"
 
@@ -11,22 +12,18 @@ class sphere : public hittable {
         const float radius;
         shared_ptr<material> mat;
         bbox bound_box;
+        shared_ptr<const affine> orientation;   // rotation of a baked sphere, turns its uv with it, null if none
 
-        static void get_sphere_uv(const vec3& p, float& u, float& v) {
-            // p: given point on a unit sphere
-            // u: returned value [0, 1] of angle wrapping around y-axis.
-            // v: returned value [0, 1] of angle from south to north pole.
-
-            float theta = std::acos(-p.y);
-            float phi = std::atan2(-p.z, p.x) + pi;
-
-            u = phi / (2.0f * pi);
-            v = theta / pi;
-        }
+        sphere(const ray& center, float radius, shared_ptr<material> mat, shared_ptr<const affine> orientation) :
+            center(center),
+            radius(radius),
+            mat(mat),
+            bound_box(bbox(center.pt() - radius, center.pt() + radius), bbox(center.at(1.0f) - radius, center.at(1.0f) + radius)),
+            orientation(orientation) {}
 
-        static vec3 random_to_sphere(float radius, float dist_sq) {
-            float r1 = random_float();
-            float r2 = random_float();
+        static vec3 random_to_sphere(float radius, float dist_sq, sampler& rng) {
+            float r1 = rng.next_float();
+            float r2 = rng.next_float();
             float z = 1.0f + r2 * (std::sqrt(1.0f - radius * radius / dist_sq) - 1);
 
             float phi = 2.0f * pi * r1;
@@ -38,6 +35,18 @@ class sphere : public hittable {
         } 
 
     public:    
+        static void get_sphere_uv(const vec3& p, float& u, float& v) {
+            // p: given point on a unit sphere
+            // u: returned value [0, 1] of angle wrapping around y-axis.
+            // v: returned value [0, 1] of angle from south to north pole.
+
+            float theta = std::acos(-p.y);
+            float phi = std::atan2(-p.z, p.x) + pi;
+
+            u = phi / (2.0f * pi);
+            v = theta / pi;
+        }
+
         sphere(const vec3& cen, float rad, shared_ptr<material> mat) : 
             center(cen, vec3()),
             radius(std::fmax(0.0f, rad)),
@@ -51,6 +60,7 @@ class sphere : public hittable {
             bound_box(bbox(cen1 - rad, cen1 + rad), bbox(cen2 - rad, cen2 + rad)) {}
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            RT_STAT(sphere_tests);
             vec3 current_center = center.at(r.time());
             vec3 oc = current_center - r.pt();
             float a = r.dir().length_squared();
@@ -73,12 +83,47 @@ class sphere : public hittable {
             rec.t = root;
             rec.pt = r.at(root);
             rec.normal = (rec.pt - current_center) / radius;
-            rec.mat = mat;
-            get_sphere_uv(rec.normal, rec.u, rec.v);
+            rec.mat = mat.get();
+            get_sphere_uv(orientation ? orientation->transposed(rec.normal) : rec.normal, rec.u, rec.v);
 
             return true;
         }
 
+        int hit_packet(ray_packet& p, int mask, const hittable** hit) const override {
+            // Moving spheres need a center per lane, leave them to the scalar test
+            if (!near_zero(center.dir())) return hittable::hit_packet(p, mask, hit);
+            RT_STAT_ADD(sphere_tests, render_stats::lanes(mask));
+
+            const vec3& c = center.pt();
+            float root[ray_packet::size];
+            bool found[ray_packet::size];
+            for (int k = 0; k < ray_packet::size; ++k) {
+                float ocx = c.x - p.o[0][k], ocy = c.y - p.o[1][k], ocz = c.z - p.o[2][k];
+                float a = p.d[0][k] * p.d[0][k] + p.d[1][k] * p.d[1][k] + p.d[2][k] * p.d[2][k];
+                float h = p.d[0][k] * ocx + p.d[1][k] * ocy + p.d[2][k] * ocz;
+                float cc = ocx * ocx + ocy * ocy + ocz * ocz - radius * radius;
+
+                float discriminant = h * h - a * cc;
+                float sqrtd = std::sqrt(std::max(discriminant, 0.0f));
+                float near_root = (h - sqrtd) / a;
+                float far_root = (h + sqrtd) / a;
+                bool near_in = p.tmin < near_root && near_root < p.tmax[k];
+                bool far_in = p.tmin < far_root && far_root < p.tmax[k];
+
+                root[k] = near_in ? near_root : far_root;
+                found[k] = discriminant >= 0.0f && (near_in || far_in);
+            }
+
+            int hits = 0;
+            for (int k = 0; k < ray_packet::size; ++k) {
+                if (!found[k] || !(mask & (1 << k))) continue;
+                p.tmax[k] = root[k];
+                hit[k] = this;
+                hits |= 1 << k;
+            }
+            return hits;
+        }
+
         bbox bounding_box() const override { return bound_box; }
 
         float pdf_value(const vec3& origin, const vec3& direction) const override {
@@ -92,11 +137,30 @@ class sphere : public hittable {
             return 1.0f / solid_angle;
         }
 
-        vec3 random(const vec3& origin) const override {
+        vec3 random(const vec3& origin, sampler& rng) const override {
             vec3 direction = center.pt() - origin;
             float dist_sq = direction.length_squared();
             onb uvw(direction);
-            return uvw.transform(random_to_sphere(radius, dist_sq));
+            return uvw.transform(random_to_sphere(radius, dist_sq, rng));
+        }
+
+        // Only rotations, translations and uniform scales keep a sphere a sphere
+        shared_ptr<hittable> transformed(const affine& to_world) const override {
+            float scale = to_world.c[0].length();
+            float tolerance = 1e-4f * scale * scale;
+            if (std::fabs(to_world.c[1].length_squared() - scale * scale) > tolerance ||
+                std::fabs(to_world.c[2].length_squared() - scale * scale) > tolerance ||
+                std::fabs(dot(to_world.c[0], to_world.c[1])) > tolerance ||
+                std::fabs(dot(to_world.c[0], to_world.c[2])) > tolerance ||
+                std::fabs(dot(to_world.c[1], to_world.c[2])) > tolerance) return nullptr;
+
+            affine rotation(to_world.c[0] / scale, to_world.c[1] / scale, to_world.c[2] / scale, vec3(0.0f));
+            if (orientation) rotation = rotation * *orientation;
+            bool turned = !near_zero(rotation.c[0] - vec3(1.0f, 0.0f, 0.0f)) || !near_zero(rotation.c[1] - vec3(0.0f, 1.0f, 0.0f));
+
+            ray moved(to_world.point(center.pt()), to_world.vector(center.dir()));
+            return shared_ptr<sphere>(new sphere(moved, radius * scale, mat,
+                                                 turned ? make_shared<const affine>(rotation) : nullptr));
         }
 };
 
@@ -2,6 +2,7 @@
 #define TRANSFORM_H
 
 #include "hittable.h"
+#include "../math/affine.h"
 #include "../math/quat.h"
 
 class transform_o : public hittable {
@@ -32,6 +33,14 @@ class transform_o : public hittable {
 
         bbox bounding_box() const override { return bound_box; }
 
+        const shared_ptr<hittable>& wrapped_object() const { return object; }
+
+        affine to_world() const { return affine(tf); }
+
+        shared_ptr<hittable> transformed(const affine& to_world) const override {
+            return object->transformed(to_world * affine(tf));
+        }
+
         shared_ptr<transform_o> translate(const vec3& offset) {
             dquat trans = dquat::translate(offset);
             tf = trans * tf;
@@ -2,21 +2,19 @@
 #define TRIANGLE_H
 
 #include "hittable.h"
+#include "../math/affine.h"
+#include "../math/triangle_intersect.h"
 
 class triangle : public hittable {
     private:
         vec3 Q;
         vec3 u, v;
+        vec3 R, S;  // the other two vertices, Q + u and Q + v
         shared_ptr<material> mat;
         bbox bound_box;
         vec3 n;
         float area;
 
-        static float determinant(vec3 c1, vec3 c2, vec3 c3) {
-            vec3 ray_cross = cross(c3, c1);
-            return dot(c2, ray_cross);
-        }
-
         void set_bbox() {
             bbox box_edge1 = bbox(Q, Q + u);
             bbox box_edge2 = bbox(Q, Q + v);
@@ -25,7 +23,7 @@ class triangle : public hittable {
 
     public:
         triangle(const vec3& Q, const vec3& a, const vec3& b, shared_ptr<material> mat) : 
-            Q(Q), u(a - Q), v(b - Q), mat(mat)
+            Q(Q), u(a - Q), v(b - Q), R(a), S(b), mat(mat)
         {
             set_bbox();
             n = cross(u, v);
@@ -35,29 +33,13 @@ class triangle : public hittable {
         bbox bounding_box() const override { return bound_box; }
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-            // using Cramer's rule to determine hits
-            float det = determinant(-r.dir(), u, v);
-            if (std::fabs(det) < 1e-8) return false;
-
-            vec3 OQ = r.pt() - Q;
-            
-            float u_det = determinant(-r.dir(), OQ, v);
-            float v_det = determinant(-r.dir(), u, OQ);
-
-            float a = u_det / det;
-            float b = v_det / det;
-
-            if (a < 0 || b < 0 || a + b > 1) return false;
-            
-            float t_det = determinant(OQ, u, v);
-            float t = t_det / det;
-            if (!ray_t.contains(t)) return false;
-
-            vec3 P = r.at(t);
+            float t, a, b;
+            RT_STAT(triangle_tests);
+            if (!intersect_triangle(r, Q, R, S, ray_t, t, a, b)) return false;
 
             rec.t = t;
-            rec.pt = P;
-            rec.mat = mat;
+            rec.pt = r.at(t);
+            rec.mat = mat.get();
             rec.normal = n.dir();
             rec.u = a;
             rec.v = b;
@@ -65,6 +47,20 @@ class triangle : public hittable {
             return true;
         }
 
+        int hit_packet(ray_packet& p, int mask, const hittable** hit) const override {
+            RT_STAT_ADD(triangle_tests, render_stats::lanes(mask));
+            int hits = 0;
+            for (int k = 0; k < ray_packet::size; ++k) {
+                float t, a, b;
+                if (!(mask & (1 << k))) continue;
+                if (!intersect_triangle(p.origin(k), p.shear[k], Q, R, S, interval(p.tmin, p.tmax[k]), t, a, b)) continue;
+                p.tmax[k] = t;
+                hit[k] = this;
+                hits |= 1 << k;
+            }
+            return hits;
+        }
+
         float pdf_value(const vec3& origin, const vec3& direction) const override {
             hit_record rec;
             if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec)) return 0.0f;
@@ -75,9 +71,13 @@ class triangle : public hittable {
             return dist_sq / (cos * area);
         }
 
-        vec3 random(const vec3& origin) const override {
-            float r1 = random_float();
-            return Q + (r1 * u) + (random_float(0, r1) * v) - origin;
+        vec3 random(const vec3& origin, sampler& rng) const override {
+            float r1 = rng.next_float();
+            return Q + (r1 * u) + (rng.next_float(0, r1) * v) - origin;
+        }
+
+        shared_ptr<hittable> transformed(const affine& to_world) const override {
+            return make_shared<triangle>(to_world.point(Q), to_world.point(R), to_world.point(S), mat);
         }
 };
 
@@ -0,0 +1,173 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "hittable.h"
+#include "../math/affine.h"
+#include "../math/triangle_intersect.h"
+#include "../utility/bvh.h"
+
+#include <cstdint>
+#include <vector>
+
+// Shared vertex and index buffers of a mesh, filled by the loaders in utility/mesh_loader.h
+struct mesh_data {
+    std::vector<vec3> positions;
+    std::vector<vec3> normals;              // one per vertex, or empty for flat shading
+    std::vector<float> uvs;                 // two per vertex, or empty to use the barycentrics
+    std::vector<std::uint32_t> indices;     // three per triangle
+
+    size_t triangle_count() const { return indices.size() / 3; }
+};
+
+// Many triangles with one material, stored as plain arrays and found through the mesh's own
+// BVH over triangle indices, so a triangle costs its 12 index bytes plus a share of the
+// vertices and tree instead of a heap allocated triangle object each. The scene level BVH
+// sees the whole mesh as one primitive.
+class triangle_mesh : public hittable {
+    private:
+        mesh_data mesh;
+        shared_ptr<material> mat;
+        std::vector<bvh_array_node> nodes;  // depth first, leaves index triangles in mesh.indices
+        bbox bound_box;
+
+        static const int max_leaf_size = 8;
+        static const int stack_size = bvh_node::max_depth;  // one entry per level at most
+
+        bool intersect(int tri, const vec3& origin, const ray_shear& shear, const interval& ray_t,
+                       float& t, float& a, float& b) const {
+            const std::uint32_t* index = &mesh.indices[3 * tri];
+            return intersect_triangle(origin, shear, mesh.positions[index[0]], mesh.positions[index[1]], mesh.positions[index[2]],
+                                      ray_t, t, a, b);
+        }
+
+    public:
+        triangle_mesh(mesh_data data, shared_ptr<material> mat) : mesh(std::move(data)), mat(mat) {
+            int count = int(mesh.triangle_count());
+            std::vector<bvh_build_box> tris(count);
+            std::vector<std::uint32_t> order(count);
+            for (int k = 0; k < count; ++k) {
+                bvh_build_box& t = tris[k];
+                for (int a = 0; a < 3; ++a) {
+                    t.bmin[a] = infinity;
+                    t.bmax[a] = -infinity;
+                }
+                for (int c = 0; c < 3; ++c) {
+                    const vec3& p = mesh.positions[mesh.indices[3 * k + c]];
+                    for (int a = 0; a < 3; ++a) {
+                        t.bmin[a] = std::min(t.bmin[a], p[a]);
+                        t.bmax[a] = std::max(t.bmax[a], p[a]);
+                    }
+                }
+                for (int a = 0; a < 3; ++a) t.centroid[a] = 0.5f * (t.bmin[a] + t.bmax[a]);
+                order[k] = k;
+            }
+
+            if (count == 0) {
+                bound_box = bbox();
+                return;
+            }
+
+            nodes.reserve(size_t(count) / 2 + 1);
+            build_flat_bvh(nodes, tris, order, max_leaf_size);
+            nodes.shrink_to_fit();
+
+            // Store the triangles in leaf order so a leaf reads one run of the index buffer
+            std::vector<std::uint32_t> sorted(mesh.indices.size());
+            for (int k = 0; k < count; ++k)
+                for (int c = 0; c < 3; ++c) sorted[3 * k + c] = mesh.indices[3 * order[k] + c];
+            mesh.indices.swap(sorted);
+
+            const bvh_array_node& root = nodes[0];
+            bound_box = bbox(vec3(root.bmin[0], root.bmin[1], root.bmin[2]), vec3(root.bmax[0], root.bmax[1], root.bmax[2]));
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            if (nodes.empty()) return false;
+
+            const vec3& origin = r.pt();
+            vec3 inv_dir(1.0f / r.dir().x, 1.0f / r.dir().y, 1.0f / r.dir().z);
+            bool dir_neg[3] = { inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f };
+            const ray_shear& shear = r.shear();
+
+            int stack[stack_size];
+            int top = 0;
+            int index = 0;
+            int hit_tri = -1;
+            float hit_a = 0.0f, hit_b = 0.0f;
+
+            while (true) {
+                const bvh_array_node& node = nodes[index];
+                RT_STAT(bvh_nodes);
+                if (node.hit(origin, inv_dir, ray_t)) {
+                    if (node.count > 0) {
+                        for (int tri = node.offset; tri < node.offset + node.count; ++tri) {
+                            float t, a, b;
+                            RT_STAT(mesh_triangle_tests);
+                            if (intersect(tri, origin, shear, ray_t, t, a, b)) {
+                                ray_t.max = t;
+                                hit_tri = tri;
+                                hit_a = a;
+                                hit_b = b;
+                            }
+                        }
+                    } else {
+                        if (dir_neg[node.axis]) {
+                            stack[top++] = index + 1;
+                            index = node.offset;
+                        } else {
+                            stack[top++] = node.offset;
+                            index = index + 1;
+                        }
+                        continue;
+                    }
+                }
+                if (top == 0) break;
+                index = stack[--top];
+            }
+
+            if (hit_tri < 0) return false;
+
+            // Fill the record once, for the closest triangle only
+            std::uint32_t i0 = mesh.indices[3 * hit_tri];
+            std::uint32_t i1 = mesh.indices[3 * hit_tri + 1];
+            std::uint32_t i2 = mesh.indices[3 * hit_tri + 2];
+            float w = 1.0f - hit_a - hit_b;
+
+            rec.t = ray_t.max;
+            rec.pt = r.at(rec.t);
+            rec.mat = mat.get();
+            if (mesh.normals.empty()) {
+                const vec3& Q = mesh.positions[i0];
+                rec.normal = cross(mesh.positions[i1] - Q, mesh.positions[i2] - Q).dir();
+            } else {
+                rec.normal = (w * mesh.normals[i0] + hit_a * mesh.normals[i1] + hit_b * mesh.normals[i2]).dir();
+            }
+            if (mesh.uvs.empty()) {
+                rec.u = hit_a;
+                rec.v = hit_b;
+            } else {
+                rec.u = w * mesh.uvs[2 * i0] + hit_a * mesh.uvs[2 * i1] + hit_b * mesh.uvs[2 * i2];
+                rec.v = w * mesh.uvs[2 * i0 + 1] + hit_a * mesh.uvs[2 * i1 + 1] + hit_b * mesh.uvs[2 * i2 + 1];
+            }
+
+            return true;
+        }
+
+        bbox bounding_box() const override { return bound_box; }
+
+        // A moved copy of the vertices with its own BVH. Normals go through the inverse
+        // transpose, so they stay perpendicular under a scale.
+        shared_ptr<hittable> transformed(const affine& to_world) const override {
+            mesh_data moved = mesh;
+            for (vec3& p : moved.positions) p = to_world.point(p);
+            affine to_object = to_world.inverse();
+            for (vec3& n : moved.normals) n = to_object.transposed(n).dir();
+            return make_shared<triangle_mesh>(std::move(moved), mat);
+        }
+
+        size_t triangle_count() const { return mesh.triangle_count(); }
+
+        size_t node_count() const { return nodes.size(); }
+};
+
+#endif
@@ -2,7 +2,7 @@
 #define RAYTRACER_H
 
 #include <cmath>
-#include <random>
+#include <cstdint>
 #include <iostream>
 #include <limits>
 #include <memory>
@@ -10,6 +10,9 @@
 using std::make_shared;
 using std::shared_ptr;
 
+#include "utility/sampler.h"
+#include "utility/render_stats.h"
+
 const float infinity = std::numeric_limits<float>::infinity();
 const float pi = 3.141592653589793285f;
 
@@ -19,10 +22,19 @@ inline float degrees_to_radians(float degrees) {
     return degrees * pi / 180.0f;
 }
 
+// Stream for scene construction (random sphere placement, perlin tables, ...). Rendering
+// never touches it, render code draws from the sampler passed down to it instead.
+inline sampler& scene_sampler() {
+    static thread_local sampler rng;
+    return rng;
+}
+
+inline void seed_random(std::uint64_t seed) {
+    scene_sampler() = sampler(seed);
+}
+
 inline float random_float() {
-    static std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-    static std::mt19937 gen;
-    return dist(gen);
+    return scene_sampler().next_float();
 }
 
 inline float random_float(float min, float max) {
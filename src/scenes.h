@@ -7,9 +7,12 @@
 #include "objects/triangle.h"
 #include "objects/bezier.h"
 #include "objects/transform.h"
+#include "objects/instance.h"
+#include "objects/triangle_mesh.h"
 
 #include "utility/bvh.h"
 #include "utility/cubemap.h"
+#include "utility/mesh_loader.h"
 
 #include "raytracer.h"
 #include "camera.h"
@@ -65,8 +68,6 @@ hittable_list bouncing_balls(config& cf) {
     cf.image_width = 1024;
     cf.aa_samples = 50;
     cf.max_depth = 16;
-    cf.tw = 256;
-    cf.th = 192;
 
     cf.vfov = 20.0f;
     cf.pos = vec3(13.0f, 2.0f, 3.0f);
@@ -251,8 +252,6 @@ pair<hittable_list, hittable_list> cornell_box(config& cf) {
 
     cf.aspect_ratio = 1.0f;
     cf.image_width  = 600;
-    cf.tw           = 200;
-    cf.th           = 200;
     cf.aa_samples   = 200;
     cf.max_depth    = 50;
 
@@ -296,8 +295,6 @@ pair<hittable_list, hittable_list> cornell_smoke(config& cf) {
 
     cf.aspect_ratio = 1.0f;
     cf.image_width  = 600;
-    cf.tw           = 200;
-    cf.th           = 200;
     cf.aa_samples   = 200;
     cf.max_depth    = 50;
 
@@ -314,8 +311,10 @@ pair<hittable_list, hittable_list> final_scene(config& cf) {
     hittable_list world;
     hittable_list lights;
 
+    // The ground boxes are instances of one unit box, stretched and moved into place
     hittable_list boxes1;
     auto ground = make_shared<lambertian>(vec3(0.48f, 0.83f, 0.53f));
+    shared_ptr<hittable> unit_box = make_shared<bvh_node>(*box(vec3(), vec3(1.0f), ground));
 
     int boxes_per_side = 20;
     for (int i = 0; i < boxes_per_side; i++) {
@@ -328,7 +327,7 @@ pair<hittable_list, hittable_list> final_scene(config& cf) {
             auto y1 = random_float(1.0f,101.0f);
             auto z1 = z0 + w;
 
-            boxes1.add(box(vec3(x0,y0,z0), vec3(x1,y1,z1), ground));
+            boxes1.add(make_shared<instance>(unit_box, affine::translate(vec3(x0,y0,z0)) * affine::scale(vec3(x1,y1,z1) - vec3(x0,y0,z0))));
         }
     }
 
@@ -364,6 +363,7 @@ pair<hittable_list, hittable_list> final_scene(config& cf) {
         boxes2.add(make_shared<sphere>(vec3::random(0.0f, 165.0f), 10.0f, white));
     }
 
+    // Placed once, so the transform is baked into the spheres when the scene is built
     world.add(make_shared<transform_o>(
         make_shared<bvh_node>(boxes2))
             ->rotate(15, vec3(0.0f, 1.0f, 0.0f))
@@ -372,8 +372,6 @@ pair<hittable_list, hittable_list> final_scene(config& cf) {
 
     cf.aspect_ratio      = 1.0;
     cf.image_width       = 400;
-    cf.tw                = 200;
-    cf.th                = 200;
     cf.aa_samples        = 250;
     cf.max_depth         = 4;
 
@@ -385,7 +383,9 @@ pair<hittable_list, hittable_list> final_scene(config& cf) {
     return pair<hittable_list, hittable_list>(world, lights);
 }
 
-pair<hittable_list, hittable_list> bezier(config& cf) {
+// Traces the patch directly, or through div x div bilinear patches cached in cache/ when
+// tesselation is above 0
+pair<hittable_list, hittable_list> bezier(config& cf, int tesselation = 0) {
     hittable_list world;
     hittable_list lights;
 
@@ -400,7 +400,10 @@ pair<hittable_list, hittable_list> bezier(config& cf) {
     bezier_patch bp(x, y, z);
 
     auto white = make_shared<lambertian>(vec3(.73f));
-    world.add(bp.tesselate(18, white));
+    if (tesselation > 0)
+        world.add(bp.tesselate(tesselation, white, "cache"));
+    else
+        world.add(make_shared<bezier_surface>(bp, white));
 
     // //right
     // for (int i = 0; i < 16; ++i) {
@@ -441,8 +444,6 @@ pair<hittable_list, hittable_list> bezier(config& cf) {
     cf.image_width = 1024;
     cf.aa_samples  = 50;
     cf.max_depth   = 16;
-    cf.tw          = 256;
-    cf.th          = 144;
 
     cf.vfov     = 20.0f;
     cf.pos      = vec3(-40.0f, 10.0f, 26.0f);
@@ -472,6 +473,50 @@ pair<hittable_list, hittable_list> scene_mirror(config& cf) {
     return pair<hittable_list, hittable_list>(world, lights);
 }
 
+pair<hittable_list, hittable_list> mesh_scene(config& cf, const string& mesh_file) {
+    hittable_list world;
+    hittable_list lights;
+
+    mesh_data mesh;
+    if (mesh_file.empty()) {
+        std::cerr << "ERROR: Scene 12 renders a mesh file, pass one with --mesh.\n";
+    } else if (load_mesh(mesh_file, mesh) && !mesh.positions.empty()) {
+        // Scale the mesh into a 2 unit box standing on the ground at the origin
+        vec3 lo(infinity), hi(-infinity);
+        for (const vec3& p : mesh.positions) {
+            lo = vec3(std::fmin(lo.x, p.x), std::fmin(lo.y, p.y), std::fmin(lo.z, p.z));
+            hi = vec3(std::fmax(hi.x, p.x), std::fmax(hi.y, p.y), std::fmax(hi.z, p.z));
+        }
+        vec3 size = hi - lo;
+        float scale = 2.0f / std::fmax(std::fmax(size.x, size.y), std::fmax(size.z, 1e-6f));
+        vec3 base((lo.x + hi.x) / 2.0f, lo.y, (lo.z + hi.z) / 2.0f);
+        for (vec3& p : mesh.positions) p = (p - base) * scale;
+
+        std::cout << "Loaded " << mesh.triangle_count() << " triangles, " << mesh.positions.size() << " vertices from " << mesh_file << '\n';
+        world.add(make_shared<triangle_mesh>(std::move(mesh), make_shared<lambertian>(vec3(.73f))));
+    }
+
+    auto checker = make_shared<checker_texture>(.5f, vec3(.2f, .3f, .1f), vec3(.9f));
+    world.add(make_shared<quad>(vec3(-10.0f, 0.0f, -10.0f), vec3(0.0f, 0.0f, 20.0f), vec3(20.0f, 0.0f, 0.0f), make_shared<lambertian>(checker)));
+
+    auto light = make_shared<emissive>(vec3(10.0f));
+    lights.add(make_shared<quad>(vec3(-1.5f, 5.0f, -1.5f), vec3(3.0f, 0.0f, 0.0f), vec3(0.0f, 0.0f, 3.0f), light));
+    world.add(lights);
+
+    cf.aspect_ratio = 1.0f;
+    cf.image_width = 600;
+    cf.aa_samples = 64;
+    cf.max_depth = 16;
+
+    cf.vfov = 30.0f;
+    cf.pos = vec3(0.0f, 2.5f, 6.0f);
+    cf.target = vec3(0.0f, 1.0f, 0.0f);
+
+    cf.background = vec3(0.1f, 0.12f, 0.15f);
+
+    return pair<hittable_list, hittable_list>(world, lights);
+}
+
 pair<hittable_list, hittable_list> test(config& cf) {
     hittable_list world;
     hittable_list lights;
@@ -500,8 +545,6 @@ pair<hittable_list, hittable_list> test(config& cf) {
     cf.image_width = 1024;
     cf.aa_samples = 50;
     cf.max_depth = 16;
-    cf.tw = 256;
-    cf.th = 144;
 
     cf.vfov = 20;
     cf.pos = vec3(26, 3, 6);
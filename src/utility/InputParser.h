@@ -61,12 +61,18 @@ vector<string> InputParser::options = {
             "--help",
             "--out",
             "--bvh",
+            "--bvh_build",
             "--display",
             "--scene",
+            "--scene_cache",
+            "--keep_transforms",
+            "--mesh",
+            "--tesselate",
             "--aspect_ratio",
             "--width",
             "--aa_samples",
             "--max_depth",
+            "--rr_depth",
             "--field_of_view",
             "--position",
             "--target",
@@ -74,7 +80,18 @@ vector<string> InputParser::options = {
             "--defocus_angle",
             "--focus_distance",
             "--background",
-            "--cubemap"
+            "--cubemap",
+            "--threads",
+            "--seed",
+            "--progressive",
+            "--time_limit",
+            "--adaptive",
+            "--min_samples",
+            "--sample_map",
+            "--cost_map",
+            "--packets",
+            "--wavefront",
+            "--benchmark"
         };
 
 void configure(const InputParser& input, config& cf) {
@@ -92,6 +109,31 @@ void configure(const InputParser& input, config& cf) {
     const string max_depth_str = input.getCmdOption("--max_depth");
     if (!max_depth_str.empty()) cf.max_depth = stoi(max_depth_str);
 
+    const string rr_depth_str = input.getCmdOption("--rr_depth");
+    if (!rr_depth_str.empty()) cf.rr_depth = stoi(rr_depth_str);
+
+    const string seed_str = input.getCmdOption("--seed");
+    if (!seed_str.empty()) cf.seed = stoull(seed_str);
+
+    if (input.cmdOptionExists("--progressive")) cf.progressive = true;
+
+    // A time budget only makes sense when every pass leaves a complete image
+    const string time_limit_str = input.getCmdOption("--time_limit");
+    if (!time_limit_str.empty()) {
+        cf.time_limit = stof(time_limit_str);
+        cf.progressive = true;
+    }
+
+    const string adaptive_str = input.getCmdOption("--adaptive");
+    if (!adaptive_str.empty()) cf.adaptive_error = stof(adaptive_str);
+
+    const string min_samples_str = input.getCmdOption("--min_samples");
+    if (!min_samples_str.empty()) cf.min_samples = stoi(min_samples_str);
+
+    if (input.cmdOptionExists("--packets")) cf.packets = true;
+    if (input.cmdOptionExists("--wavefront")) cf.wavefront = true;
+    if (input.cmdOptionExists("--cost_map")) cf.cost_map = true;
+
     const string vfov_str = input.getCmdOption("--field_of_view");
     if (!vfov_str.empty()) cf.vfov = stof(vfov_str);
 
@@ -114,7 +156,7 @@ void configure(const InputParser& input, config& cf) {
     if (!background_str.empty()) cf.background = vec3::stov(background_str);
 
     const string cubemap_str = input.getCmdOption("--cubemap");
-    if (!cubemap_str.empty()) cf.cmap = cubemap_str.c_str();
+    if (!cubemap_str.empty()) cf.cmap = cubemap_str;
 }
 
 #endif
\ No newline at end of file
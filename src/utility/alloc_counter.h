@@ -0,0 +1,109 @@
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+// Counts every call to the global operator new, to check that the render loop does not touch the
+// heap. Only compiled in with RAYTRACER_COUNT_ALLOCATIONS, and replacing operator new has to
+// happen in exactly one translation unit, so only main.cpp includes this header. Every form is
+// replaced (plain, array, nothrow and over-aligned), so alignas types like render_stats::block
+// are counted too.
+
+#ifdef RAYTRACER_COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+namespace alloc_counter {
+    inline std::atomic<std::uint64_t> allocations{0};
+
+    inline std::uint64_t count() { return allocations.load(std::memory_order_relaxed); }
+
+    inline void* allocate(std::size_t size) noexcept {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        return std::malloc(size ? size : 1);
+    }
+
+    inline void* allocate(std::size_t size, std::align_val_t align) noexcept {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        std::size_t a = std::size_t(align);
+        if (a < sizeof(void*)) a = sizeof(void*);
+        // aligned_alloc wants a size that is a multiple of the alignment
+        size = (size + a - 1) / a * a;
+#ifdef _WIN32
+        return _aligned_malloc(size ? size : a, a);
+#else
+        return std::aligned_alloc(a, size ? size : a);
+#endif
+    }
+
+    inline void release_aligned(void* p) noexcept {
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        std::free(p);
+#endif
+    }
+}
+
+void* operator new(std::size_t size) {
+    if (void* p = alloc_counter::allocate(size)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return alloc_counter::allocate(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return alloc_counter::allocate(size); }
+
+void* operator new(std::size_t size, std::align_val_t align) {
+    if (void* p = alloc_counter::allocate(size, align)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t align) {
+    return operator new(size, align);
+}
+
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return alloc_counter::allocate(size, align);
+}
+
+void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return alloc_counter::allocate(size, align);
+}
+
+// GCC pairs operator new with operator delete at inlined call sites and doesn't know these
+// deletes free memory from the malloc above, so it would flag every delete in the program
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+
+void operator delete(void* p, std::align_val_t) noexcept { alloc_counter::release_aligned(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { alloc_counter::release_aligned(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { alloc_counter::release_aligned(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { alloc_counter::release_aligned(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { alloc_counter::release_aligned(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { alloc_counter::release_aligned(p); }
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#endif
+
+#endif
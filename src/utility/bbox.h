@@ -3,6 +3,28 @@
 
 #include "../raytracer.h"
 #include "../math/ray.h"
+#include "simd.h"
+
+#if defined(RAYTRACER_SSE) || defined(RAYTRACER_NEON)
+// Narrows ray_t by the entry and exit distances of the x, y and z slabs in lanes 0 to 2, in the
+// same order and with the same comparisons as the scalar slab tests, so both agree on every ray
+inline bool slab_overlap(vec3_register near, vec3_register far, interval ray_t) {
+    alignas(16) float n[4], f[4];
+#if defined(RAYTRACER_SSE)
+    _mm_store_ps(n, near);
+    _mm_store_ps(f, far);
+#else
+    vst1q_f32(n, near);
+    vst1q_f32(f, far);
+#endif
+    for (int axis = 0; axis < 3; ++axis) {
+        ray_t.min = std::max(n[axis], ray_t.min);
+        ray_t.max = std::min(f[axis], ray_t.max);
+        if (ray_t.max <= ray_t.min) return false;
+    }
+    return true;
+}
+#endif
 
 class bbox {
     private:
@@ -83,6 +105,15 @@ class bbox {
         }
 
         bool hit(const ray& r, interval ray_t) const {
+#if defined(RAYTRACER_SSE)
+            // The intervals are stored min, max per axis; two overlapping loads and a shuffle
+            // each gather the three mins and the three maxes
+            __m128 lo = _mm_loadu_ps(&i[0].min);
+            __m128 hi = _mm_loadu_ps(&i[1].min);
+            __m128 t0 = _mm_div_ps(_mm_sub_ps(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 2, 2, 0)), r.pt().m), r.dir().m);
+            __m128 t1 = _mm_div_ps(_mm_sub_ps(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 3, 3, 1)), r.pt().m), r.dir().m);
+            return slab_overlap(_mm_min_ps(t0, t1), _mm_max_ps(t1, t0), ray_t);
+#else
             const vec3& point = r.pt();
             const vec3& dir   = r.dir();
 
@@ -103,6 +134,7 @@ class bbox {
                 if (ray_t.max <= ray_t.min) return false;
             }
             return true;
+#endif
         }
 };
 
@@ -2,16 +2,18 @@
 #define BVH_H
 
 #include "bbox.h"
+#include "thread_pool.h"
 #include "../objects/hittable.h"
 #include "../objects/hittable_list.h"
 
 #include <vector>
 #include <functional>
 #include <iterator>
+#include <algorithm>
 #include <cfloat>
+#include <cstdint>
 
-// LOOK AT THE LINK IN THE GOOGLE DOC
-// TODO: Make a Linear BVH or a Hybrid BVH
+// bvh_tree below is the flattened version of bvh_node, picked with --bvh flat
 
 
 class split_plane {
@@ -64,10 +66,22 @@ bool compareZ(shared_ptr<hittable> a, shared_ptr<hittable> b) {
 
 using compare_func = bool(*)(shared_ptr<hittable>, shared_ptr<hittable>);
 
+// sweep:  exact SAH over every box edge, sorts at every level, O(n log^2 n), single threaded
+// binned: SAH over 16 centroid bins, partitions in place, O(n log n), subtrees built in parallel
+enum class bvh_build { sweep, binned };
+
+inline float surface_area(const bbox& box) {
+    float dx = box[0].size(), dy = box[1].size(), dz = box[2].size();
+    return 2.0f * (dx * dy + dx * dz + dy * dz);
+}
+
 class bvh_node : public hittable {
     private:
         static compare_func comparators[3];
 
+        static const int bin_count = 16;
+        static const int parallel_threshold = 4096;  // smaller ranges are built on the current thread
+
         split_plane find_best_split_plane(std::vector<shared_ptr<hittable>>& objects, int start, int end) {
             float min_sam = FLT_MAX;
             split_plane best_plane;
@@ -75,7 +89,7 @@ class bvh_node : public hittable {
                 std::vector<split_plane> candidates;
                 candidates.reserve((end - start) * 2);
                 for (auto it = objects.begin() + start; it != objects.begin() + end; ++it) {
-                    interval& obox = (*it)->bounding_box()[axis];
+                    interval obox = (*it)->bounding_box()[axis];
                     // std::cout << "(" << obox.min << ", " << obox.max << ") | ";
                     split_plane p0(obox.min, axis, true);
                     split_plane p1(obox.max, axis, false);
@@ -107,17 +121,116 @@ class bvh_node : public hittable {
             return best_plane;
         }
 
+        // Bins object centroids along each axis, evaluates SAH at the bin boundaries and partitions
+        // objects around the cheapest one. Returns the split index, or -1 if the centroids coincide.
+        int binned_split(std::vector<shared_ptr<hittable>>& objects, int start, int end) {
+            std::vector<bbox> boxes;
+            boxes.reserve(end - start);
+            bbox centroids(interval::empty, interval::empty, interval::empty);
+            for (int k = start; k < end; ++k) {
+                boxes.push_back(objects[k]->bounding_box());
+                const bbox& b = boxes.back();
+                for (int a = 0; a < 3; ++a) {
+                    float c = 0.5f * (b[a].min + b[a].max);
+                    centroids[a] = interval(centroids[a], interval(c, c));
+                }
+            }
+
+            float best_cost = FLT_MAX;
+            int best_axis = -1;
+            int best_bin = 0;
+            for (int a = 0; a < 3; ++a) {
+                float extent = centroids[a].size();
+                if (extent <= 0.0f) continue;
+                float scale = bin_count / extent;
+
+                bbox bins[bin_count];
+                int counts[bin_count] = {};
+                for (int b = 0; b < bin_count; ++b) bins[b] = bbox(interval::empty, interval::empty, interval::empty);
+
+                for (const bbox& box : boxes) {
+                    float c = 0.5f * (box[a].min + box[a].max);
+                    int b = std::min(bin_count - 1, int((c - centroids[a].min) * scale));
+                    bins[b] = bbox(bins[b], box);
+                    ++counts[b];
+                }
+
+                // Cost of splitting after bin b: left side sweeps forward, right side backward
+                float right_area[bin_count];
+                int right_count[bin_count];
+                bbox acc(interval::empty, interval::empty, interval::empty);
+                int n = 0;
+                for (int b = bin_count - 1; b > 0; --b) {
+                    acc = bbox(acc, bins[b]);
+                    n += counts[b];
+                    right_area[b - 1] = n ? surface_area(acc) : 0.0f;
+                    right_count[b - 1] = n;
+                }
+
+                acc = bbox(interval::empty, interval::empty, interval::empty);
+                n = 0;
+                for (int b = 0; b < bin_count - 1; ++b) {
+                    acc = bbox(acc, bins[b]);
+                    n += counts[b];
+                    if (!n || !right_count[b]) continue;
+                    float cost = n * surface_area(acc) + right_count[b] * right_area[b];
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_axis = a;
+                        best_bin = b;
+                    }
+                }
+            }
+
+            if (best_axis < 0) return -1;
+
+            axis = best_axis;
+            float cmin = centroids[best_axis].min;
+            float scale = bin_count / centroids[best_axis].size();
+            auto mid = std::partition(objects.begin() + start, objects.begin() + end,
+                [=](const shared_ptr<hittable>& o) {
+                    bbox box = o->bounding_box();
+                    float c = 0.5f * (box[best_axis].min + box[best_axis].max);
+                    return std::min(bin_count - 1, int((c - cmin) * scale)) <= best_bin;
+                });
+            return int(mid - objects.begin());
+        }
+
+        void sah_sums(float& inner, float& leaves) const {
+            if (leaf) {
+                leaves += (left == right ? 1 : 2) * surface_area(bound_box);
+                return;
+            }
+            inner += surface_area(bound_box);
+            static_cast<const bvh_node*>(left.get())->sah_sums(inner, leaves);
+            static_cast<const bvh_node*>(right.get())->sah_sums(inner, leaves);
+        }
+
         shared_ptr<hittable> left;
         shared_ptr<hittable> right;
         bbox bound_box;
-        bool leaf;
+        bool leaf = false;
+        int axis = 0;
 
     public:
-        bvh_node(hittable_list list) : bvh_node(list.objects, 0, list.objects.size()) {
-            std::cout << "BVH Tree successfully constructed\n";
+        // Builder used when none is given, set from --bvh_build
+        static inline bvh_build default_build = bvh_build::sweep;
+
+        // Ranges deeper than median_depth are split at the median instead of by SAH, here and
+        // in flat_bvh_builder. Every split then halves the range, so the tree stays within
+        // max_depth (32 more levels hold 2^31 objects), the size of the traversal stacks.
+        static const int median_depth = 32;
+        static const int max_depth = 64;
+
+        bvh_node(hittable_list list, bvh_build method = default_build) :
+            bvh_node(list.objects, 0, list.objects.size(), method) {
+            std::cout << "BVH Tree successfully constructed ("
+                      << (method == bvh_build::binned ? "binned" : "sweep")
+                      << " SAH), SAH cost " << sah_cost() << '\n';
         }
 
-        bvh_node(std::vector<shared_ptr<hittable>>& objects, int start, int end) {
+        bvh_node(std::vector<shared_ptr<hittable>>& objects, int start, int end, bvh_build method = default_build,
+                 int depth = 0) {
             // std::cout << "Constructing (" << start << ", " << end << ")\n";
             for (auto it = objects.begin() + start; it != objects.begin() + end; ++it)
                 bound_box = bbox(bound_box, (*it)->bounding_box());
@@ -129,18 +242,45 @@ class bvh_node : public hittable {
                 left = objects[start];
                 right = objects[start + 1];
                 leaf = true;
+            } else if (depth >= median_depth) {
+                // A long run of lopsided SAH splits (nested or very uneven objects) would outgrow
+                // the traversal stacks, so from here on split at the median of the longest axis
+                for (int a = 1; a < 3; ++a)
+                    if (bound_box[a].size() > bound_box[axis].size()) axis = a;
+                int mid = (start + end) / 2;
+                std::nth_element(objects.begin() + start, objects.begin() + mid, objects.begin() + end, comparators[axis]);
+                left = make_shared<bvh_node>(objects, start, mid, method, depth + 1);
+                right = make_shared<bvh_node>(objects, mid, end, method, depth + 1);
+            } else if (method == bvh_build::binned) {
+                int mid = binned_split(objects, start, end);
+                if (mid <= start || mid >= end) mid = (start + end) / 2;
+
+                if (end - start >= parallel_threshold) {
+                    thread_pool& pool = thread_pool::global();
+                    task_group children;
+                    pool.submit(children, [&, start, mid, method, depth] {
+                        left = make_shared<bvh_node>(objects, start, mid, method, depth + 1);
+                    });
+                    right = make_shared<bvh_node>(objects, mid, end, method, depth + 1);
+                    pool.wait(children);
+                } else {
+                    left = make_shared<bvh_node>(objects, start, mid, method, depth + 1);
+                    right = make_shared<bvh_node>(objects, mid, end, method, depth + 1);
+                }
             } else {
                 split_plane best_plane = find_best_split_plane(objects, start, end);
+                axis = best_plane.axis;
                 int mid = best_plane.left_count + start;
                 if (mid == end || mid == start) mid = (start + end) / 2;
-                left = make_shared<bvh_node>(objects, start, mid);
-                right = make_shared<bvh_node>(objects, mid, end);
+                left = make_shared<bvh_node>(objects, start, mid, method, depth + 1);
+                right = make_shared<bvh_node>(objects, mid, end, method, depth + 1);
             }
 
             bound_box = bbox(left->bounding_box(), right->bounding_box());
         }
 
         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            RT_STAT(bvh_nodes);
             if (!bound_box.hit(r, ray_t)) return false;
 
             bool hit_left = left->hit(r, ray_t, rec);
@@ -156,89 +296,395 @@ class bvh_node : public hittable {
         shared_ptr<hittable> right_object() const { return right; }
 
         bool is_leaf() const { return leaf; }
+
+        shared_ptr<hittable> transformed(const affine& to_world) const override;
+
+        int split_axis() const { return axis; }
+
+        // Expected cost of a random ray hitting the root, with unit traversal and intersection
+        // costs: sum of interior areas plus primitive counts times leaf areas, over the root area
+        float sah_cost() const {
+            float inner = 0.0f, leaves = 0.0f;
+            sah_sums(inner, leaves);
+            return (inner + leaves) / surface_area(bound_box);
+        }
 };
 
 compare_func bvh_node::comparators[] = {&compareX, &compareY, &compareZ};
 
-// class bvh_array_node {
-//     public:
-//     bool leaf = false;
-//     int left, right;
-//     bbox bound_box;
-
-//     bvh_array_node(const std::unordered_map<hittable*, int>& objects, bvh_node* node) {
-//         if (node->is_leaf()) {
-//             left = objects.at(node->left_object().get());
-//             right = objects.at(node->right_object().get());
-//             leaf = true;
-//         }
-//     }
-
-//     bool hit(const ray& r, interval ray_t, hit_record& rec) const {
-//         if (!bound_box.hit(r, ray_t)) return false;
-//     }
-// };
-
-
-// // Make the tree contiguous in memory by using an array
-// class bvh_tree : public hittable {
-//     private:
-//         bvh_node root;
-//         std::vector<bvh_array_node> bvh_array;
-//         std::unordered_map<hittable*, int> objects_map;
-//         std::vector<shared_ptr<hittable>>& objects;
-
-//         int tree_to_array(bvh_node* node) {
-//             int index = bvh_array.size();
-//             bvh_array.emplace_back(objects_map, node);
-//             std::cout << node->left_object().get() << ", " << dynamic_cast<bvh_node*>(node->right_object().get()) << ", " << node << ", " << index << '\n';
-//             bvh_array_node& a_node = bvh_array[index];
-//             if (!a_node.leaf) {
-//                 // bvh_node* left = (static_cast<bvh_node*>(node->left_object().get()));
-//                 // std::cout << left->bounding_box()[0].min << ", " << left->bounding_box()[0].max << ", " << (static_cast<bvh_node*>(node->left_object().get())) << '\n';
-//                 a_node.left = tree_to_array((static_cast<bvh_node*>(node->left_object().get())));
-//                 a_node.right = tree_to_array((static_cast<bvh_node*>(node->right_object().get())));
-//             }
-//             std::cout << a_node.left << ", " << a_node.right << "\n";
-//             return index;
-//         }
-
-//     public:
-//         bvh_tree(hittable_list list) : root(list.objects, 0, list.objects.size()), objects(list.objects) {
-//             for (int i = 0; i < objects.size(); ++i) {
-//                 objects_map[objects[i].get()] = i;
-//             }
-
-//             tree_to_array(&root);
-
-//             for (bvh_array_node& node : bvh_array) {
-//                 std::cout << node.left << ", " << node.right << "\n";
-//             }
-//         }
-
-//         bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-//             std::stack<bvh_array_node> stack;
-//             stack.push(bvh_array[0]);
-//             bool hit = false;
-//             while (!stack.empty()) {
-//                 bvh_array_node node = stack.top();
-//                 stack.pop();
-//                 if (node.bound_box.hit(r, ray_t)) {
-//                     if (!node.leaf) {
-//                         stack.push(bvh_array[node.right]);
-//                         stack.push(bvh_array[node.left]);
-//                     } else {
-//                         bool left_hit = objects[node.left]->hit(r, ray_t, rec);
-//                         if (left_hit) ray_t.max = rec.t;
-//                         bool right_hit = objects[node.right]->hit(r, ray_t, rec);
-//                         hit = hit || left_hit || right_hit;
-//                     }
-//                 }
-//             }
-//             return hit;
-//         };
-
-//         bbox bounding_box() const { return bvh_array[0].bound_box; }
-// };
+// Nested lists and trees would be opaque leaves, pull their contents up into one tree
+inline void gather_primitives(const shared_ptr<hittable>& object, std::vector<shared_ptr<hittable>>& out) {
+    if (auto list = std::dynamic_pointer_cast<hittable_list>(object)) {
+        for (const auto& o : list->objects) gather_primitives(o, out);
+    } else if (auto node = std::dynamic_pointer_cast<bvh_node>(object)) {
+        gather_primitives(node->left_object(), out);
+        if (node->right_object() != node->left_object()) gather_primitives(node->right_object(), out);
+    } else {
+        out.push_back(object);
+    }
+}
+
+// The moved primitives get a tree of their own, moving a box doesn't move the boxes inside it
+inline shared_ptr<hittable> bvh_node::transformed(const affine& to_world) const {
+    std::vector<shared_ptr<hittable>> objects;
+    gather_primitives(left, objects);
+    if (right != left) gather_primitives(right, objects);
+    for (auto& object : objects)
+        if (!(object = object->transformed(to_world))) return nullptr;
+    return make_shared<bvh_node>(objects, 0, int(objects.size()));
+}
+
+// 32 byte node of the flattened tree. Nodes are stored depth first, so the first child of an
+// interior node is the next node in the array and only the second child needs an index.
+struct bvh_array_node {
+    float bmin[3];
+    float bmax[3];
+    std::int32_t offset;    // interior: index of the second child, leaf: index of the first primitive
+    std::uint16_t count;    // primitives in the leaf, 0 for interior nodes
+    std::uint8_t axis;      // split axis, used to visit the nearer child first
+    std::uint8_t pad;
+
+    bool hit(const vec3& origin, const vec3& inv_dir, interval ray_t) const {
+#if defined(RAYTRACER_SSE)
+        // Each load takes the next field along in its fourth lane, slab_overlap ignores it
+        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bmin), origin.m), inv_dir.m);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(bmax), origin.m), inv_dir.m);
+        return slab_overlap(_mm_min_ps(t1, t0), _mm_max_ps(t0, t1), ray_t);
+#elif defined(RAYTRACER_NEON)
+        float32x4_t b0 = {bmin[0], bmin[1], bmin[2], 0.0f};
+        float32x4_t b1 = {bmax[0], bmax[1], bmax[2], 0.0f};
+        float32x4_t t0 = vmulq_f32(vsubq_f32(b0, origin.m), inv_dir.m);
+        float32x4_t t1 = vmulq_f32(vsubq_f32(b1, origin.m), inv_dir.m);
+        return slab_overlap(vbslq_f32(vcgtq_f32(t0, t1), t1, t0), vbslq_f32(vcgtq_f32(t0, t1), t0, t1), ray_t);
+#else
+        for (int a = 0; a < 3; ++a) {
+            float t0 = (bmin[a] - origin[a]) * inv_dir[a];
+            float t1 = (bmax[a] - origin[a]) * inv_dir[a];
+            if (t0 > t1) std::swap(t0, t1);
+            ray_t.min = std::max(t0, ray_t.min);
+            ray_t.max = std::min(t1, ray_t.max);
+            if (ray_t.max <= ray_t.min) return false;
+        }
+        return true;
+#endif
+    }
+};
+
+static_assert(sizeof(bvh_array_node) == 32, "bvh_array_node should fill half a cache line");
+
+// Bounds of one primitive for build_flat_bvh
+struct bvh_build_box {
+    float bmin[3], bmax[3], centroid[3];
+};
+
+// Binned SAH over box centroids into a depth first node array, same scheme as bvh_node's binned
+// builder, for objects that keep their own tree over plain arrays instead of hittables
+class flat_bvh_builder {
+    private:
+        std::vector<bvh_array_node>& nodes;
+        const std::vector<bvh_build_box>& boxes;
+        std::vector<std::uint32_t>& order;
+        int max_leaf_size;
+
+        static const int bins = 16;
+        // SAH cost of visiting a node, in primitive tests. At 4 rather than 1 leaves fill up to
+        // max_leaf_size, which cuts the node count to about a third and traverses faster.
+        static constexpr float node_cost = 4.0f;
+
+        static float half_area(const float* bmin, const float* bmax) {
+            float dx = bmax[0] - bmin[0], dy = bmax[1] - bmin[1], dz = bmax[2] - bmin[2];
+            return dx * dy + dx * dz + dy * dz;
+        }
+
+        static void grow(float* bmin, float* bmax, const float* pmin, const float* pmax) {
+            for (int a = 0; a < 3; ++a) {
+                bmin[a] = std::min(bmin[a], pmin[a]);
+                bmax[a] = std::max(bmax[a], pmax[a]);
+            }
+        }
+
+        int build(int start, int end, int depth) {
+            int index = int(nodes.size());
+            nodes.emplace_back();
+            bvh_array_node& node = nodes[index];
+
+            float cmin[3] = {infinity, infinity, infinity}, cmax[3] = {-infinity, -infinity, -infinity};
+            for (int a = 0; a < 3; ++a) {
+                node.bmin[a] = infinity;
+                node.bmax[a] = -infinity;
+            }
+            for (int k = start; k < end; ++k) {
+                const bvh_build_box& t = boxes[order[k]];
+                grow(node.bmin, node.bmax, t.bmin, t.bmax);
+                grow(cmin, cmax, t.centroid, t.centroid);
+            }
+
+            int count = end - start;
+            if (depth >= bvh_node::median_depth) return build_median(index, start, end, depth, cmin, cmax);
+
+            int best_axis = -1, best_bin = 0;
+            float best_cost = infinity;
+            float leaf_cost = float(count) * half_area(node.bmin, node.bmax);
+
+            for (int a = 0; a < 3 && count > 1; ++a) {
+                float extent = cmax[a] - cmin[a];
+                if (extent <= 0.0f) continue;
+                float scale = bins / extent;
+
+                int bin_count[bins] = {};
+                float bin_min[bins][3], bin_max[bins][3];
+                for (int b = 0; b < bins; ++b) {
+                    for (int c = 0; c < 3; ++c) {
+                        bin_min[b][c] = infinity;
+                        bin_max[b][c] = -infinity;
+                    }
+                }
+                for (int k = start; k < end; ++k) {
+                    const bvh_build_box& t = boxes[order[k]];
+                    int b = std::min(bins - 1, int((t.centroid[a] - cmin[a]) * scale));
+                    ++bin_count[b];
+                    grow(bin_min[b], bin_max[b], t.bmin, t.bmax);
+                }
+
+                // Sweep from the right to get the cost of every right side, then from the left
+                float right_area[bins];
+                int right_count[bins];
+                float acc_min[3] = {infinity, infinity, infinity}, acc_max[3] = {-infinity, -infinity, -infinity};
+                int n = 0;
+                for (int b = bins - 1; b > 0; --b) {
+                    n += bin_count[b];
+                    grow(acc_min, acc_max, bin_min[b], bin_max[b]);
+                    right_area[b] = n ? half_area(acc_min, acc_max) : 0.0f;
+                    right_count[b] = n;
+                }
+                for (int c = 0; c < 3; ++c) {
+                    acc_min[c] = infinity;
+                    acc_max[c] = -infinity;
+                }
+                n = 0;
+                for (int b = 0; b < bins - 1; ++b) {
+                    n += bin_count[b];
+                    grow(acc_min, acc_max, bin_min[b], bin_max[b]);
+                    if (!n || !right_count[b + 1]) continue;
+                    float cost = node_cost * half_area(node.bmin, node.bmax) +
+                                 n * half_area(acc_min, acc_max) + right_count[b + 1] * right_area[b + 1];
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_axis = a;
+                        best_bin = b;
+                    }
+                }
+            }
+
+            if (count <= max_leaf_size && leaf_cost <= best_cost) {
+                node.offset = start;
+                node.count = std::uint16_t(count);
+                node.axis = 0;
+                return index;
+            }
+
+            int mid;
+            if (best_axis >= 0) {
+                float scale = bins / (cmax[best_axis] - cmin[best_axis]);
+                auto left = [&](std::uint32_t t) {
+                    return std::min(bins - 1, int((boxes[t].centroid[best_axis] - cmin[best_axis]) * scale)) <= best_bin;
+                };
+                mid = int(std::partition(order.begin() + start, order.begin() + end, left) - order.begin());
+            } else {
+                // Centroids all coincide but the leaf would be too big, halve it
+                best_axis = 0;
+                mid = (start + end) / 2;
+            }
+
+            return split(index, start, mid, end, best_axis, depth);
+        }
+
+        int split(int index, int start, int mid, int end, int axis, int depth) {
+            nodes[index].count = 0;
+            nodes[index].axis = std::uint8_t(axis);
+            build(start, mid, depth + 1);
+            int right = build(mid, end, depth + 1);
+            nodes[index].offset = right;
+            return index;
+        }
+
+        // Past bvh_node::median_depth, halve the range at the centroid median of its longest axis
+        // so the tree stays within bvh_node::max_depth, the size of the traversal stacks
+        int build_median(int index, int start, int end, int depth, const float* cmin, const float* cmax) {
+            if (end - start <= max_leaf_size) {
+                nodes[index].offset = start;
+                nodes[index].count = std::uint16_t(end - start);
+                nodes[index].axis = 0;
+                return index;
+            }
+
+            int axis = 0;
+            for (int a = 1; a < 3; ++a)
+                if (cmax[a] - cmin[a] > cmax[axis] - cmin[axis]) axis = a;
+            int mid = (start + end) / 2;
+            std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end,
+                             [&](std::uint32_t x, std::uint32_t y) {
+                                 return boxes[x].centroid[axis] < boxes[y].centroid[axis];
+                             });
+            return split(index, start, mid, end, axis, depth);
+        }
+
+    public:
+        flat_bvh_builder(std::vector<bvh_array_node>& nodes, const std::vector<bvh_build_box>& boxes,
+                         std::vector<std::uint32_t>& order, int max_leaf_size) :
+            nodes(nodes), boxes(boxes), order(order), max_leaf_size(max_leaf_size) {}
+
+        int build() { return build(0, int(order.size()), 0); }
+};
+
+// Builds nodes over boxes. order starts as the primitive indices to put in the tree and ends up
+// in leaf order, leaves hold runs of it.
+inline void build_flat_bvh(std::vector<bvh_array_node>& nodes, const std::vector<bvh_build_box>& boxes,
+                           std::vector<std::uint32_t>& order, int max_leaf_size) {
+    flat_bvh_builder(nodes, boxes, order, max_leaf_size).build();
+}
+
+// Make the tree contiguous in memory by using an array, traversed with an explicit stack
+class bvh_tree : public hittable {
+    private:
+        std::vector<bvh_array_node> nodes;
+        std::vector<shared_ptr<hittable>> objects;  // keeps the primitives alive
+        std::vector<const hittable*> prims;         // primitives in leaf order
+        bbox bound_box;
+
+        static const int stack_size = bvh_node::max_depth;  // one entry per level at most
+
+        int flatten(const bvh_node* node) {
+            int index = int(nodes.size());
+            nodes.emplace_back();
+
+            bbox box = node->bounding_box();
+            for (int a = 0; a < 3; ++a) {
+                nodes[index].bmin[a] = box[a].min;
+                nodes[index].bmax[a] = box[a].max;
+            }
+
+            if (node->is_leaf()) {
+                nodes[index].offset = int(prims.size());
+                prims.push_back(node->left_object().get());
+                if (node->right_object() != node->left_object()) prims.push_back(node->right_object().get());
+                nodes[index].count = std::uint16_t(prims.size() - nodes[index].offset);
+                nodes[index].axis = 0;
+            } else {
+                nodes[index].count = 0;
+                nodes[index].axis = std::uint8_t(node->split_axis());
+                flatten(static_cast<const bvh_node*>(node->left_object().get()));
+                nodes[index].offset = flatten(static_cast<const bvh_node*>(node->right_object().get()));
+            }
+            return index;
+        }
+
+        // Single ray traversal of the subtree under root, also reporting the primitive that was hit
+        bool traverse(int root, const ray& r, interval ray_t, hit_record& rec, const hittable*& hit_prim) const {
+            const vec3& origin = r.pt();
+            vec3 inv_dir(1.0f / r.dir().x, 1.0f / r.dir().y, 1.0f / r.dir().z);
+            bool dir_neg[3] = { inv_dir.x < 0.0f, inv_dir.y < 0.0f, inv_dir.z < 0.0f };
+
+            int stack[stack_size];
+            int top = 0;
+            int index = root;
+            bool hit_anything = false;
+
+            while (true) {
+                const bvh_array_node& node = nodes[index];
+                RT_STAT(bvh_nodes);
+                if (node.hit(origin, inv_dir, ray_t)) {
+                    if (node.count > 0) {
+                        for (int i = node.offset; i < node.offset + node.count; ++i) {
+                            if (prims[i]->hit(r, ray_t, rec)) {
+                                hit_anything = true;
+                                ray_t.max = rec.t;
+                                hit_prim = prims[i];
+                            }
+                        }
+                    } else {
+                        // Front to back: descend into the child on the near side of the split
+                        if (dir_neg[node.axis]) {
+                            stack[top++] = index + 1;
+                            index = node.offset;
+                        } else {
+                            stack[top++] = node.offset;
+                            index = index + 1;
+                        }
+                        continue;
+                    }
+                }
+                if (top == 0) break;
+                index = stack[--top];
+            }
+
+            return hit_anything;
+        }
+
+    public:
+        bvh_tree(hittable_list list, bvh_build method = bvh_node::default_build) {
+            for (const auto& object : list.objects) gather_primitives(object, objects);
+
+            bvh_node root(objects, 0, int(objects.size()), method);
+            nodes.reserve(2 * objects.size());
+            prims.reserve(objects.size());
+            flatten(&root);
+            bound_box = root.bounding_box();
+
+            std::cout << "Flat BVH successfully constructed (" << nodes.size() << " nodes, "
+                      << prims.size() << " primitives), SAH cost " << root.sah_cost() << '\n';
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            const hittable* hit_prim;
+            return traverse(0, r, ray_t, rec, hit_prim);
+        }
+
+        // Packet traversal: a node is entered when any lane hits its box and children are visited
+        // in the order of the first active lane. Once a single lane is left in a subtree the
+        // packet has diverged and that lane finishes the subtree as a single ray.
+        int hit_packet(ray_packet& p, int mask, const hittable** hit) const override {
+            int stack[stack_size];
+            int top = 0;
+            int index = 0;
+            if (!mask) return 0;
+            int hits = 0;
+            int lead = ray_packet::first_lane(mask);
+
+            while (true) {
+                const bvh_array_node& node = nodes[index];
+                RT_STAT(bvh_nodes);
+                int active = p.hit_box(node.bmin, node.bmax, mask);
+                if (active && !(active & (active - 1))) {
+                    int k = ray_packet::first_lane(active);
+                    hit_record rec;
+                    if (traverse(index, p.lane(k), interval(p.tmin, p.tmax[k]), rec, hit[k])) {
+                        p.tmax[k] = rec.t;
+                        hits |= active;
+                    }
+                } else if (active) {
+                    if (node.count > 0) {
+                        for (int i = node.offset; i < node.offset + node.count; ++i)
+                            hits |= prims[i]->hit_packet(p, active, hit);
+                    } else {
+                        if (p.d[node.axis][lead] < 0.0f) {
+                            stack[top++] = index + 1;
+                            index = node.offset;
+                        } else {
+                            stack[top++] = node.offset;
+                            index = index + 1;
+                        }
+                        continue;
+                    }
+                }
+                if (top == 0) break;
+                index = stack[--top];
+            }
+
+            return hits;
+        }
+
+        bbox bounding_box() const override { return bound_box; }
+};
 
 #endif
\ No newline at end of file
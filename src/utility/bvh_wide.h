@@ -0,0 +1,294 @@
+#ifndef BVH_WIDE_H
+#define BVH_WIDE_H
+
+#include "bvh.h"
+#include "simd.h"
+
+#include <cstdint>
+#include <string>
+
+// N-ary node with the child boxes stored as SoA rows, so all N boxes are tested against a ray
+// in one go. Rows are min x, min y, min z, max x, max y, max z.
+template <int N>
+struct alignas(32) bvh_wide_node {
+    float bounds[6][N];
+    std::int32_t child[N];  // inner child: node index, leaf child: index of its first primitive
+    std::uint16_t count[N]; // primitives in a leaf child, 0 for inner children
+    std::uint32_t valid;    // bit per occupied child slot
+};
+
+// Ray data shared by every box test of one traversal
+struct wide_ray {
+    float origin[3];
+    float inv_dir[3];
+    float tmin, tmax;
+};
+
+namespace wide_kernels {
+
+// Each kernel writes the entry distance of every child to tnear and returns a bit mask of the
+// children whose box the ray enters before tmax
+
+template <int N>
+int hit_scalar(const bvh_wide_node<N>& node, const wide_ray& r, float* tnear) {
+    int mask = 0;
+    for (int k = 0; k < N; ++k) {
+        float t_enter = r.tmin;
+        float t_exit = r.tmax;
+        for (int a = 0; a < 3; ++a) {
+            float t0 = (node.bounds[a][k] - r.origin[a]) * r.inv_dir[a];
+            float t1 = (node.bounds[a + 3][k] - r.origin[a]) * r.inv_dir[a];
+            t_enter = std::max(t_enter, std::min(t0, t1));
+            t_exit = std::min(t_exit, std::max(t0, t1));
+        }
+        tnear[k] = t_enter;
+        mask |= int(t_enter < t_exit) << k;
+    }
+    return mask & node.valid;
+}
+
+#if defined(RAYTRACER_SSE)
+
+template <int N>
+int hit_sse(const bvh_wide_node<N>& node, const wide_ray& r, float* tnear) {
+    __m128 o[3], inv[3];
+    for (int a = 0; a < 3; ++a) {
+        o[a] = _mm_set1_ps(r.origin[a]);
+        inv[a] = _mm_set1_ps(r.inv_dir[a]);
+    }
+
+    int mask = 0;
+    for (int k = 0; k < N; k += 4) {
+        __m128 t_enter = _mm_set1_ps(r.tmin);
+        __m128 t_exit = _mm_set1_ps(r.tmax);
+        for (int a = 0; a < 3; ++a) {
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[a] + k), o[a]), inv[a]);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.bounds[a + 3] + k), o[a]), inv[a]);
+            t_enter = _mm_max_ps(t_enter, _mm_min_ps(t0, t1));
+            t_exit = _mm_min_ps(t_exit, _mm_max_ps(t0, t1));
+        }
+        _mm_storeu_ps(tnear + k, t_enter);
+        mask |= _mm_movemask_ps(_mm_cmplt_ps(t_enter, t_exit)) << k;
+    }
+    return mask & node.valid;
+}
+
+RAYTRACER_TARGET_AVX2
+inline int hit_avx2(const bvh_wide_node<8>& node, const wide_ray& r, float* tnear) {
+    __m256 t_enter = _mm256_set1_ps(r.tmin);
+    __m256 t_exit = _mm256_set1_ps(r.tmax);
+    for (int a = 0; a < 3; ++a) {
+        __m256 o = _mm256_set1_ps(r.origin[a]);
+        __m256 inv = _mm256_set1_ps(r.inv_dir[a]);
+        __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[a]), o), inv);
+        __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(node.bounds[a + 3]), o), inv);
+        t_enter = _mm256_max_ps(t_enter, _mm256_min_ps(t0, t1));
+        t_exit = _mm256_min_ps(t_exit, _mm256_max_ps(t0, t1));
+    }
+    _mm256_storeu_ps(tnear, t_enter);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t_enter, t_exit, _CMP_LT_OQ)) & node.valid;
+}
+
+#elif defined(RAYTRACER_NEON)
+
+template <int N>
+int hit_neon(const bvh_wide_node<N>& node, const wide_ray& r, float* tnear) {
+    static const uint32_t lane_bits[4] = {1, 2, 4, 8};
+    uint32x4_t bits = vld1q_u32(lane_bits);
+
+    int mask = 0;
+    for (int k = 0; k < N; k += 4) {
+        float32x4_t t_enter = vdupq_n_f32(r.tmin);
+        float32x4_t t_exit = vdupq_n_f32(r.tmax);
+        for (int a = 0; a < 3; ++a) {
+            float32x4_t o = vdupq_n_f32(r.origin[a]);
+            float32x4_t inv = vdupq_n_f32(r.inv_dir[a]);
+            float32x4_t t0 = vmulq_f32(vsubq_f32(vld1q_f32(node.bounds[a] + k), o), inv);
+            float32x4_t t1 = vmulq_f32(vsubq_f32(vld1q_f32(node.bounds[a + 3] + k), o), inv);
+            t_enter = vmaxq_f32(t_enter, vminq_f32(t0, t1));
+            t_exit = vminq_f32(t_exit, vmaxq_f32(t0, t1));
+        }
+        vst1q_f32(tnear + k, t_enter);
+        mask |= int(vaddvq_u32(vandq_u32(vcltq_f32(t_enter, t_exit), bits))) << k;
+    }
+    return mask & node.valid;
+}
+
+#endif
+
+}
+
+// Wide BVH collapsed from the binary bvh_node tree, picked with --bvh wide4 / --bvh wide8
+template <int N>
+class bvh_wide : public hittable {
+    private:
+        using node_kernel = int (*)(const bvh_wide_node<N>&, const wide_ray&, float*);
+
+        struct stack_entry {
+            std::int32_t index;
+            std::uint16_t count;
+            float t;
+        };
+
+        // A wide node is no deeper than the bvh_node it came from, and a visit pushes at most N
+        // children for the one it pops
+        static const int stack_size = bvh_node::max_depth * N;
+
+        std::vector<bvh_wide_node<N>> nodes;
+        std::vector<shared_ptr<hittable>> objects;  // keeps the primitives alive
+        std::vector<const hittable*> prims;         // primitives in leaf order
+        bbox bound_box;
+        node_kernel hit_children;
+        std::string kernel_name;
+
+        void select_kernel() {
+            hit_children = &wide_kernels::hit_scalar<N>;
+            kernel_name = "scalar";
+#if defined(RAYTRACER_SSE)
+            hit_children = &wide_kernels::hit_sse<N>;
+            kernel_name = "SSE";
+            if constexpr (N == 8) {
+                if (simd::has_avx2()) {
+                    hit_children = &wide_kernels::hit_avx2;
+                    kernel_name = "AVX2";
+                }
+            }
+#elif defined(RAYTRACER_NEON)
+            hit_children = &wide_kernels::hit_neon<N>;
+            kernel_name = "NEON";
+#endif
+        }
+
+        // Pulls the binary tree up into one N-ary node by repeatedly opening the largest
+        // interior child until N slots are used
+        int collapse(const bvh_node* node) {
+            std::vector<const bvh_node*> kids;
+            if (node->is_leaf()) {
+                kids.push_back(node);
+            } else {
+                kids.push_back(static_cast<const bvh_node*>(node->left_object().get()));
+                kids.push_back(static_cast<const bvh_node*>(node->right_object().get()));
+            }
+
+            while (int(kids.size()) < N) {
+                int widest = -1;
+                float widest_area = -1.0f;
+                for (int k = 0; k < int(kids.size()); ++k) {
+                    if (kids[k]->is_leaf()) continue;
+                    float area = surface_area(kids[k]->bounding_box());
+                    if (area > widest_area) {
+                        widest_area = area;
+                        widest = k;
+                    }
+                }
+                if (widest < 0) break;
+
+                const bvh_node* opened = kids[widest];
+                kids[widest] = static_cast<const bvh_node*>(opened->left_object().get());
+                kids.push_back(static_cast<const bvh_node*>(opened->right_object().get()));
+            }
+
+            int index = int(nodes.size());
+            nodes.emplace_back();
+            nodes[index].valid = 0;
+            for (int k = 0; k < N; ++k) {
+                for (int a = 0; a < 3; ++a) {
+                    nodes[index].bounds[a][k] = 0.0f;
+                    nodes[index].bounds[a + 3][k] = 0.0f;
+                }
+                nodes[index].child[k] = -1;
+                nodes[index].count[k] = 0;
+            }
+
+            for (int k = 0; k < int(kids.size()); ++k) {
+                bbox box = kids[k]->bounding_box();
+                for (int a = 0; a < 3; ++a) {
+                    nodes[index].bounds[a][k] = box[a].min;
+                    nodes[index].bounds[a + 3][k] = box[a].max;
+                }
+                nodes[index].valid |= 1u << k;
+
+                if (kids[k]->is_leaf()) {
+                    int offset = int(prims.size());
+                    prims.push_back(kids[k]->left_object().get());
+                    if (kids[k]->right_object() != kids[k]->left_object())
+                        prims.push_back(kids[k]->right_object().get());
+                    nodes[index].child[k] = offset;
+                    nodes[index].count[k] = std::uint16_t(prims.size() - offset);
+                } else {
+                    int child = collapse(kids[k]);
+                    nodes[index].child[k] = child;
+                }
+            }
+            return index;
+        }
+
+    public:
+        bvh_wide(hittable_list list, bvh_build method = bvh_node::default_build) {
+            static_assert(N == 4 || N == 8, "bvh_wide supports 4 and 8 wide nodes");
+            for (const auto& object : list.objects) gather_primitives(object, objects);
+
+            bvh_node root(objects, 0, int(objects.size()), method);
+            prims.reserve(objects.size());
+            collapse(&root);
+            bound_box = root.bounding_box();
+            select_kernel();
+
+            std::cout << "Wide BVH" << N << " successfully constructed (" << nodes.size() << " nodes, "
+                      << prims.size() << " primitives, " << kernel_name << " box tests)\n";
+        }
+
+        bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+            wide_ray wr;
+            for (int a = 0; a < 3; ++a) {
+                wr.origin[a] = r.pt()[a];
+                wr.inv_dir[a] = 1.0f / r.dir()[a];
+            }
+            wr.tmin = ray_t.min;
+
+            stack_entry stack[stack_size];
+            int top = 0;
+            stack[top++] = {0, 0, ray_t.min};
+            bool hit_anything = false;
+
+            while (top > 0) {
+                stack_entry entry = stack[--top];
+                if (entry.t >= ray_t.max) continue;
+
+                if (entry.count > 0) {
+                    for (int i = entry.index; i < entry.index + entry.count; ++i) {
+                        if (prims[i]->hit(r, ray_t, rec)) {
+                            hit_anything = true;
+                            ray_t.max = rec.t;
+                        }
+                    }
+                    continue;
+                }
+
+                const bvh_wide_node<N>& node = nodes[entry.index];
+                RT_STAT(bvh_nodes);
+                wr.tmax = ray_t.max;
+                alignas(32) float tnear[N];
+                int mask = hit_children(node, wr, tnear);
+
+                // Push hit children far to near so the nearest one is popped first
+                int first = top;
+                for (int k = 0; k < N; ++k) {
+                    if (!(mask & (1 << k))) continue;
+                    stack_entry child = {node.child[k], node.count[k], tnear[k]};
+                    int j = top++;
+                    while (j > first && stack[j - 1].t < child.t) {
+                        stack[j] = stack[j - 1];
+                        --j;
+                    }
+                    stack[j] = child;
+                }
+            }
+
+            return hit_anything;
+        }
+
+        bbox bounding_box() const override { return bound_box; }
+};
+
+#endif
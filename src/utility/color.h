@@ -9,6 +9,10 @@ inline float linear_to_gamma(float linear_component) {
     return 0;
 }
 
+inline float luminance(const vec3& c) {
+    return 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+}
+
 void write_color(std::ostream& out, const vec3& pixel_color) {
     float r = pixel_color.x;
     float g = pixel_color.y;
@@ -70,4 +74,18 @@ void write_color(std::vector<std::uint8_t>& pixels, const vec3& pixel_color, int
     pixels[i + 3] = static_cast<std::uint8_t>(255);
 }
 
+// Blue -> green -> red ramp for t in [0, 1], used for per pixel statistics images
+void write_heat(std::vector<std::uint8_t>& pixels, float t, int i) {
+    static const interval unit(0.0f, 1.0f);
+    t = unit.clamp(t);
+    float r = unit.clamp(2.0f * t - 1.0f);
+    float g = 1.0f - std::fabs(2.0f * t - 1.0f);
+    float b = unit.clamp(1.0f - 2.0f * t);
+
+    pixels[i] = static_cast<std::uint8_t>(std::floor(255.0f * r));
+    pixels[i + 1] = static_cast<std::uint8_t>(std::floor(255.0f * g));
+    pixels[i + 2] = static_cast<std::uint8_t>(std::floor(255.0f * b));
+    pixels[i + 3] = static_cast<std::uint8_t>(255);
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,365 @@
+#ifndef MESH_LOADER_H
+#define MESH_LOADER_H
+
+#include "../objects/triangle_mesh.h"
+
+#include <cctype>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Loaders for Wavefront OBJ and PLY (ascii or binary) files into mesh_data. Both read the file
+// front to back without holding its text in memory. Like image loading, a file that cannot be
+// read prints an error and leaves the mesh empty.
+
+namespace mesh_loader_detail {
+
+// One corner of an OBJ face: position, texture and normal index, -1 when missing
+struct obj_corner {
+    int v, vt, vn;
+
+    bool operator==(const obj_corner& o) const { return v == o.v && vt == o.vt && vn == o.vn; }
+};
+
+struct obj_corner_hash {
+    size_t operator()(const obj_corner& c) const {
+        return size_t(sampler::hash(std::uint64_t(std::uint32_t(c.v)), (std::uint64_t(std::uint32_t(c.vt)) << 32) | std::uint32_t(c.vn)));
+    }
+};
+
+// OBJ indices are 1 based, negative ones count back from the last element read so far
+inline int obj_index(const char*& s, int size) {
+    char* end;
+    long i = std::strtol(s, &end, 10);
+    if (end == s) return -1;
+    s = end;
+    return int(i < 0 ? size + i : i - 1);
+}
+
+inline obj_corner parse_obj_corner(const char*& s, int positions, int uvs, int normals) {
+    obj_corner c = {obj_index(s, positions), -1, -1};
+    if (*s == '/') {
+        ++s;
+        if (*s != '/') c.vt = obj_index(s, uvs);
+        if (*s == '/') {
+            ++s;
+            c.vn = obj_index(s, normals);
+        }
+    }
+    return c;
+}
+
+}
+
+inline bool load_obj(const std::string& path, mesh_data& mesh) {
+    using namespace mesh_loader_detail;
+
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "ERROR: Could not load mesh file '" << path << "'.\n";
+        return false;
+    }
+
+    std::vector<vec3> positions, normals;
+    std::vector<float> uvs;
+    std::unordered_map<obj_corner, std::uint32_t, obj_corner_hash> vertex_of;
+    std::vector<obj_corner> polygon;
+    bool has_uvs = false, has_normals = false;
+    bool by_corner = false;
+
+    mesh = mesh_data();
+
+    // Faces with bare position indices use them as mesh vertices directly. Once a corner brings
+    // a texture or normal index, each distinct v/vt/vn corner becomes its own mesh vertex. If
+    // earlier faces used bare indices, the positions read so far stay the first vertices.
+    auto vertex = [&](const obj_corner& c) {
+        if (!by_corner && c.vt < 0 && c.vn < 0) return std::uint32_t(c.v);
+        if (!by_corner) {
+            by_corner = true;
+            if (!mesh.indices.empty())
+                for (int v = 0; v < int(positions.size()); ++v) vertex_of.emplace(obj_corner{v, -1, -1}, std::uint32_t(v));
+        }
+        auto found = vertex_of.try_emplace(c, std::uint32_t(vertex_of.size()));
+        return found.first->second;
+    };
+
+    std::string line;
+    while (std::getline(file, line)) {
+        const char* s = line.c_str();
+        while (*s == ' ' || *s == '\t') ++s;
+
+        if (s[0] == 'v' && (s[1] == ' ' || s[1] == '\t')) {
+            char* end;
+            float x = std::strtof(s + 2, &end);
+            float y = std::strtof(end, &end);
+            float z = std::strtof(end, &end);
+            positions.emplace_back(x, y, z);
+        } else if (s[0] == 'v' && s[1] == 't') {
+            char* end;
+            float u = std::strtof(s + 2, &end);
+            float v = std::strtof(end, &end);
+            uvs.push_back(u);
+            uvs.push_back(v);
+        } else if (s[0] == 'v' && s[1] == 'n') {
+            char* end;
+            float x = std::strtof(s + 2, &end);
+            float y = std::strtof(end, &end);
+            float z = std::strtof(end, &end);
+            normals.emplace_back(x, y, z);
+        } else if (s[0] == 'f' && (s[1] == ' ' || s[1] == '\t')) {
+            polygon.clear();
+            s += 2;
+            while (true) {
+                while (*s == ' ' || *s == '\t' || *s == '\r') ++s;
+                if (!*s) break;
+                obj_corner c = parse_obj_corner(s, int(positions.size()), int(uvs.size() / 2), int(normals.size()));
+                if (c.v < 0 || c.v >= int(positions.size())) break;
+                if (c.vt >= int(uvs.size() / 2)) c.vt = -1;
+                if (c.vn >= int(normals.size())) c.vn = -1;
+                has_uvs |= c.vt >= 0;
+                has_normals |= c.vn >= 0;
+                polygon.push_back(c);
+                while (*s && *s != ' ' && *s != '\t') ++s;
+            }
+
+            // Fan triangulation of convex polygons
+            for (size_t k = 2; k < polygon.size(); ++k) {
+                mesh.indices.push_back(vertex(polygon[0]));
+                mesh.indices.push_back(vertex(polygon[k - 1]));
+                mesh.indices.push_back(vertex(polygon[k]));
+            }
+        }
+    }
+
+    if (!by_corner) {
+        mesh.positions = std::move(positions);
+        return true;
+    }
+
+    mesh.positions.resize(vertex_of.size());
+    if (has_normals) mesh.normals.assign(vertex_of.size(), vec3());
+    if (has_uvs) mesh.uvs.assign(2 * vertex_of.size(), 0.0f);
+    for (const auto& entry : vertex_of) {
+        const obj_corner& c = entry.first;
+        std::uint32_t i = entry.second;
+        mesh.positions[i] = positions[c.v];
+        if (has_normals && c.vn >= 0) mesh.normals[i] = normals[c.vn];
+        if (has_uvs && c.vt >= 0) {
+            mesh.uvs[2 * i] = uvs[2 * c.vt];
+            mesh.uvs[2 * i + 1] = uvs[2 * c.vt + 1];
+        }
+    }
+
+    return true;
+}
+
+namespace mesh_loader_detail {
+
+enum class ply_format { ascii, binary_little_endian, binary_big_endian };
+
+enum class ply_type { int8, uint8, int16, uint16, int32, uint32, float32, float64, invalid };
+
+struct ply_property {
+    std::string name;
+    ply_type type;
+    ply_type count_type = ply_type::invalid;   // set for list properties
+};
+
+struct ply_element {
+    std::string name;
+    size_t count;
+    std::vector<ply_property> properties;
+};
+
+inline ply_type ply_type_of(const std::string& name) {
+    if (name == "char" || name == "int8") return ply_type::int8;
+    if (name == "uchar" || name == "uint8") return ply_type::uint8;
+    if (name == "short" || name == "int16") return ply_type::int16;
+    if (name == "ushort" || name == "uint16") return ply_type::uint16;
+    if (name == "int" || name == "int32") return ply_type::int32;
+    if (name == "uint" || name == "uint32") return ply_type::uint32;
+    if (name == "float" || name == "float32") return ply_type::float32;
+    if (name == "double" || name == "float64") return ply_type::float64;
+    return ply_type::invalid;
+}
+
+template <typename T>
+T ply_read_binary(std::istream& in, bool swap) {
+    unsigned char bytes[sizeof(T)];
+    in.read(reinterpret_cast<char*>(bytes), sizeof(T));
+    if (swap)
+        for (size_t k = 0; k < sizeof(T) / 2; ++k) std::swap(bytes[k], bytes[sizeof(T) - 1 - k]);
+    T value;
+    std::memcpy(&value, bytes, sizeof(T));
+    return value;
+}
+
+// Reads one value of a PLY scalar type from the stream as a double
+inline double ply_read(std::istream& in, ply_type type, ply_format format) {
+    if (format == ply_format::ascii) {
+        double value = 0.0;
+        in >> value;
+        return value;
+    }
+
+    static const bool little_host = [] { std::uint16_t one = 1; return *reinterpret_cast<unsigned char*>(&one) == 1; }();
+    bool swap = (format == ply_format::binary_little_endian) != little_host;
+    switch (type) {
+        case ply_type::int8:    return ply_read_binary<std::int8_t>(in, swap);
+        case ply_type::uint8:   return ply_read_binary<std::uint8_t>(in, swap);
+        case ply_type::int16:   return ply_read_binary<std::int16_t>(in, swap);
+        case ply_type::uint16:  return ply_read_binary<std::uint16_t>(in, swap);
+        case ply_type::int32:   return ply_read_binary<std::int32_t>(in, swap);
+        case ply_type::uint32:  return ply_read_binary<std::uint32_t>(in, swap);
+        case ply_type::float32: return ply_read_binary<float>(in, swap);
+        default:                return ply_read_binary<double>(in, swap);
+    }
+}
+
+}
+
+inline bool load_ply(const std::string& path, mesh_data& mesh) {
+    using namespace mesh_loader_detail;
+
+    std::ifstream file(path, std::ios::binary);
+    std::string line;
+    if (!file || !std::getline(file, line) || line.compare(0, 3, "ply") != 0) {
+        std::cerr << "ERROR: Could not load mesh file '" << path << "'.\n";
+        return false;
+    }
+
+    ply_format format = ply_format::ascii;
+    std::vector<ply_element> elements;
+    while (std::getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        std::istringstream words(line);
+        std::string keyword;
+        words >> keyword;
+
+        if (keyword == "format") {
+            std::string name;
+            words >> name;
+            if (name == "binary_little_endian") format = ply_format::binary_little_endian;
+            else if (name == "binary_big_endian") format = ply_format::binary_big_endian;
+        } else if (keyword == "element") {
+            ply_element element;
+            words >> element.name >> element.count;
+            elements.push_back(element);
+        } else if (keyword == "property" && !elements.empty()) {
+            ply_property property;
+            std::string type, count_type;
+            words >> type;
+            if (type == "list") words >> count_type >> type;
+            words >> property.name;
+            property.type = ply_type_of(type);
+            if (!count_type.empty()) property.count_type = ply_type_of(count_type);
+            if (property.type == ply_type::invalid || (!count_type.empty() && property.count_type == ply_type::invalid)) {
+                std::cerr << "ERROR: Unsupported PLY property type in '" << path << "': " << line << '\n';
+                return false;
+            }
+            elements.back().properties.push_back(property);
+        } else if (keyword == "end_header") {
+            break;
+        }
+    }
+
+    mesh = mesh_data();
+    std::vector<double> values;
+    std::vector<std::uint32_t> polygon;
+
+    for (const ply_element& element : elements) {
+        bool vertices = element.name == "vertex";
+        bool faces = element.name == "face";
+
+        // Which of this element's properties feed which vertex attribute
+        int position_of[3] = {-1, -1, -1}, normal_of[3] = {-1, -1, -1}, uv_of[2] = {-1, -1};
+        for (int p = 0; p < int(element.properties.size()); ++p) {
+            const std::string& name = element.properties[p].name;
+            for (int a = 0; a < 3; ++a) {
+                if (name == std::string(1, char('x' + a))) position_of[a] = p;
+                if (name == std::string("n") + char('x' + a)) normal_of[a] = p;
+            }
+            if (name == "u" || name == "s" || name == "texture_u") uv_of[0] = p;
+            if (name == "v" || name == "t" || name == "texture_v") uv_of[1] = p;
+        }
+        if (vertices && (position_of[0] < 0 || position_of[1] < 0 || position_of[2] < 0)) {
+            std::cerr << "ERROR: Mesh file '" << path << "' has vertices without x, y and z.\n";
+            mesh = mesh_data();
+            return false;
+        }
+        bool has_normals = vertices && normal_of[0] >= 0 && normal_of[1] >= 0 && normal_of[2] >= 0;
+        bool has_uvs = vertices && uv_of[0] >= 0 && uv_of[1] >= 0;
+        if (vertices) {
+            mesh.positions.reserve(element.count);
+            if (has_normals) mesh.normals.reserve(element.count);
+            if (has_uvs) mesh.uvs.reserve(2 * element.count);
+        }
+
+        values.resize(element.properties.size());
+        for (size_t e = 0; e < element.count && file; ++e) {
+            for (size_t p = 0; p < element.properties.size(); ++p) {
+                const ply_property& property = element.properties[p];
+                if (property.count_type == ply_type::invalid) {
+                    values[p] = ply_read(file, property.type, format);
+                    continue;
+                }
+
+                int n = int(ply_read(file, property.count_type, format));
+                bool indices = faces && (property.name == "vertex_indices" || property.name == "vertex_index");
+                polygon.clear();
+                for (int k = 0; k < n; ++k) {
+                    double value = ply_read(file, property.type, format);
+                    if (indices) polygon.push_back(std::uint32_t(value));
+                }
+                for (size_t k = 2; k < polygon.size(); ++k) {
+                    mesh.indices.push_back(polygon[0]);
+                    mesh.indices.push_back(polygon[k - 1]);
+                    mesh.indices.push_back(polygon[k]);
+                }
+            }
+
+            if (vertices) {
+                mesh.positions.emplace_back(float(values[position_of[0]]), float(values[position_of[1]]), float(values[position_of[2]]));
+                if (has_normals)
+                    mesh.normals.emplace_back(float(values[normal_of[0]]), float(values[normal_of[1]]), float(values[normal_of[2]]));
+                if (has_uvs) {
+                    mesh.uvs.push_back(float(values[uv_of[0]]));
+                    mesh.uvs.push_back(float(values[uv_of[1]]));
+                }
+            }
+        }
+    }
+
+    if (!file) {
+        std::cerr << "ERROR: Mesh file '" << path << "' ended early.\n";
+        mesh = mesh_data();
+        return false;
+    }
+
+    // Drop faces that point past the vertex list rather than reading out of bounds later
+    for (std::uint32_t i : mesh.indices) {
+        if (i >= mesh.positions.size()) {
+            std::cerr << "ERROR: Mesh file '" << path << "' has faces with invalid vertex indices.\n";
+            mesh = mesh_data();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Picks the loader from the file extension
+inline bool load_mesh(const std::string& path, mesh_data& mesh) {
+    std::string extension = path.substr(path.find_last_of('.') + 1);
+    for (char& c : extension) c = char(std::tolower(c));
+    if (extension == "ply") return load_ply(path, mesh);
+    return load_obj(path, mesh);
+}
+
+#endif
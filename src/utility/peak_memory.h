@@ -0,0 +1,71 @@
+#ifndef PEAK_MEMORY_H
+#define PEAK_MEMORY_H
+
+#include <cstdint>
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+#if defined(__linux__)
+    #include <cstdio>
+    #include <cstring>
+    #if defined(__GLIBC__)
+        #include <malloc.h>
+    #endif
+#endif
+
+// Most memory the process has held in RAM since it started or since the last successful
+// reset_peak_rss(), in bytes, or 0 where it can't be read
+inline std::uint64_t peak_rss_bytes() {
+#if defined(__linux__)
+    // VmHWM is the high-water mark reset_peak_rss() clears, ru_maxrss below is never cleared
+    if (std::FILE* status = std::fopen("/proc/self/status", "r")) {
+        char line[256];
+        unsigned long long kb = 0;
+        bool found = false;
+        while (!found && std::fgets(line, sizeof(line), status))
+            found = std::strncmp(line, "VmHWM:", 6) == 0 && std::sscanf(line + 6, "%llu", &kb) == 1;
+        std::fclose(status);
+        if (found) return std::uint64_t(kb) * 1024;
+    }
+#endif
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+    #if defined(__APPLE__)
+        return std::uint64_t(usage.ru_maxrss);          // bytes on macOS
+    #else
+        return std::uint64_t(usage.ru_maxrss) * 1024;   // kilobytes on Linux and the BSDs
+    #endif
+#endif
+}
+
+// Starts the peak over from what the process holds now, so the next peak_rss_bytes() covers
+// only what came after, e.g. one benchmark scene. Only Linux can do this, elsewhere it returns
+// false and the peak keeps covering the whole run.
+inline bool reset_peak_rss() {
+#if defined(__linux__)
+    #if defined(__GLIBC__)
+        malloc_trim(0);     // freed heap the allocator kept would still count as held
+    #endif
+    std::FILE* refs = std::fopen("/proc/self/clear_refs", "w");
+    if (!refs) return false;
+    bool written = std::fputs("5", refs) >= 0;
+    return std::fclose(refs) == 0 && written;
+#else
+    return false;
+#endif
+}
+
+#endif
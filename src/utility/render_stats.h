@@ -0,0 +1,147 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+// Hot path counters for finding out where render time goes: rays by kind, BVH nodes visited,
+// primitive tests and material scatters by type, and how long paths get. Only compiled in with
+// RAYTRACER_STATS, otherwise the RT_STAT macros expand to nothing and cost nothing.
+//
+// Every thread counts into its own block, which only that thread writes to, so counting is a
+// plain load and store with no locked instruction or shared cache line. Reading the totals sums
+// the blocks of all threads that ever counted anything.
+
+#ifdef RAYTRACER_STATS
+
+#include <atomic>
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace render_stats {
+
+enum counter {
+    primary_rays, secondary_rays, light_samples,
+    bvh_nodes,
+    sphere_tests, quad_tests, triangle_tests, patch_tests, mesh_triangle_tests, bezier_cell_tests, medium_tests,
+    lambertian_scatters, metal_scatters, dielectric_scatters, isotropic_scatters, emissive_scatters,
+    counter_count
+};
+
+const char* const counter_names[counter_count] = {
+    "primary_rays", "secondary_rays", "light_samples",
+    "bvh_nodes",
+    "sphere_tests", "quad_tests", "triangle_tests", "patch_tests", "mesh_triangle_tests", "bezier_cell_tests", "medium_tests",
+    "lambertian_scatters", "metal_scatters", "dielectric_scatters", "isotropic_scatters", "emissive_scatters"
+};
+
+// Path lengths in rays traced, the last bucket also holds every longer path
+const int path_buckets = 33;
+
+// Cache line aligned so the blocks of two threads never share a line
+struct alignas(64) block {
+    std::atomic<std::uint64_t> counts[counter_count]{};
+    std::atomic<std::uint64_t> path_lengths[path_buckets]{};
+};
+
+struct totals {
+    std::uint64_t counts[counter_count] = {};
+    std::uint64_t path_lengths[path_buckets] = {};
+};
+
+// Blocks are never freed, so the counts of pool threads that have exited still add up
+inline std::mutex blocks_lock;
+inline std::vector<std::unique_ptr<block>> blocks;
+
+inline block& local() {
+    thread_local block* mine = [] {
+        std::lock_guard<std::mutex> guard(blocks_lock);
+        blocks.push_back(std::make_unique<block>());
+        return blocks.back().get();
+    }();
+    return *mine;
+}
+
+inline void bump(std::atomic<std::uint64_t>& value, std::uint64_t n) {
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+inline void add(counter c, std::uint64_t n = 1) { bump(local().counts[c], n); }
+
+inline void path_length(int rays) { bump(local().path_lengths[rays < path_buckets ? rays : path_buckets - 1], 1); }
+
+// What this thread has counted so far in counters first to last, e.g. to charge a pixel with
+// the work done between two readings
+inline std::uint64_t thread_count(counter first, counter last) {
+    std::uint64_t sum = 0;
+    for (int c = first; c <= last; ++c) sum += local().counts[c].load(std::memory_order_relaxed);
+    return sum;
+}
+
+// Lanes set in a packet mask
+inline int lanes(int mask) { return int(std::bitset<32>(unsigned(mask)).count()); }
+
+inline totals collect() {
+    std::lock_guard<std::mutex> guard(blocks_lock);
+    totals t;
+    for (const auto& b : blocks) {
+        for (int c = 0; c < counter_count; ++c) t.counts[c] += b->counts[c].load(std::memory_order_relaxed);
+        for (int k = 0; k < path_buckets; ++k) t.path_lengths[k] += b->path_lengths[k].load(std::memory_order_relaxed);
+    }
+    return t;
+}
+
+// Only between renders, while no thread is counting
+inline void reset() {
+    std::lock_guard<std::mutex> guard(blocks_lock);
+    for (const auto& b : blocks) {
+        for (auto& c : b->counts) c.store(0, std::memory_order_relaxed);
+        for (auto& k : b->path_lengths) k.store(0, std::memory_order_relaxed);
+    }
+}
+
+inline int last_path_bucket(const totals& t) {
+    int last = 0;
+    for (int k = 0; k < path_buckets; ++k) if (t.path_lengths[k]) last = k;
+    return last;
+}
+
+inline void print(std::ostream& out) {
+    totals t = collect();
+    out << "Render statistics:\n";
+    for (int c = 0; c < counter_count; ++c) {
+        if (t.counts[c]) out << "    " << counter_names[c] << ": " << t.counts[c] << '\n';
+    }
+    out << "    path length (rays): count\n";
+    for (int k = 0; k <= last_path_bucket(t); ++k) {
+        out << "        " << k << (k == path_buckets - 1 ? "+" : "") << ": " << t.path_lengths[k] << '\n';
+    }
+}
+
+// A JSON object with every counter and the path length histogram, indented to sit at depth indent
+inline void write_json(std::ostream& out, const std::string& indent) {
+    totals t = collect();
+    out << "{\n";
+    for (int c = 0; c < counter_count; ++c) out << indent << "  \"" << counter_names[c] << "\": " << t.counts[c] << ",\n";
+    out << indent << "  \"path_lengths\": [";
+    for (int k = 0; k <= last_path_bucket(t); ++k) out << (k ? ", " : "") << t.path_lengths[k];
+    out << "]\n" << indent << "}";
+}
+
+}
+
+#define RT_STAT(name) render_stats::add(render_stats::name)
+#define RT_STAT_ADD(name, n) render_stats::add(render_stats::name, n)
+#define RT_STAT_PATH(rays) render_stats::path_length(rays)
+
+#else
+
+#define RT_STAT(name) ((void)0)
+#define RT_STAT_ADD(name, n) ((void)0)
+#define RT_STAT_PATH(rays) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+
+// PCG32 random number stream (pcg-random.org). Render code builds one per (seed, pixel, sample)
+// so every sample of every pixel draws the same numbers no matter which thread renders it.
+class sampler {
+    private:
+        std::uint64_t state;
+        std::uint64_t inc;
+
+        static std::uint64_t splitmix(std::uint64_t x) {
+            x += 0x9e3779b97f4a7c15ull;
+            x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+            x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+            return x ^ (x >> 31);
+        }
+
+    public:
+        sampler(std::uint64_t seed = 0, std::uint64_t stream = 0) : state(0), inc((stream << 1u) | 1u) {
+            next_uint();
+            state += splitmix(seed);
+            next_uint();
+        }
+
+        sampler(std::uint64_t seed, std::uint64_t pixel, std::uint64_t sample) :
+            sampler(splitmix(seed ^ splitmix(pixel)), sample) {}
+
+        std::uint32_t next_uint() {
+            std::uint64_t old = state;
+            state = old * 6364136223846793005ull + inc;
+            std::uint32_t xorshifted = std::uint32_t(((old >> 18u) ^ old) >> 27u);
+            std::uint32_t rot = std::uint32_t(old >> 59u);
+            return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+        }
+
+        // Uniform in [0, 1)
+        float next_float() {
+            return float(next_uint() >> 8) * (1.0f / 16777216.0f);
+        }
+
+        float next_float(float min, float max) {
+            return min + (max - min) * next_float();
+        }
+
+        // Uniform in [min, max)
+        int next_int(int min, int max) {
+            return min + int(next_float() * (max - min));
+        }
+
+        static std::uint64_t hash(std::uint64_t a, std::uint64_t b) {
+            return splitmix(a ^ splitmix(b));
+        }
+};
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include "mapped_file.h"
+#include "../objects/packed_primitives.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+// Binary copy of what loading a scene file builds from its packed primitive lines: the
+// primitives in leaf order and their BVH, plus the text of the remaining lines (camera,
+// textures, materials and objects that can't be packed), each after its line number in the
+// scene file so errors still point at the right line. It is named after a hash of the scene
+// file and mapped back in on later runs, where packed_primitives uses the arrays where they
+// lie instead of parsing and building anything.
+//
+// Only top level spheres, quads and triangles are cached. A mesh line is read from its OBJ or
+// PLY file and gets its BVH built on every run, so a scene made mostly of meshes loads no
+// faster with a cache. The cache isn't smaller than the text either: each primitive takes a
+// 44 byte record whatever its kind plus about 0.7 BVH nodes of 32 bytes, some 65 bytes for a
+// sphere that a scene line writes in about 40.
+//
+// Layout: the 64 byte header, then node_count bvh_array_nodes, prim_count packed_primitives
+// and text_size bytes of text. open() checks the arrays with packed_primitives::valid(). The
+// arrays keep the alignment their types need because the mapping starts on a page boundary
+// and every size before them is a multiple of 4.
+class scene_cache {
+    public:
+        struct header {
+            char magic[8];
+            std::uint32_t version;
+            std::uint16_t node_size;
+            std::uint16_t prim_size;
+            std::uint64_t key;          // content_hash() of the scene file
+            std::uint64_t scene_size;   // bytes in the scene file, compared along with the key
+            std::uint64_t node_count;
+            std::uint64_t prim_count;
+            std::uint64_t text_size;
+            std::uint64_t material_count;   // materials the primitives index, defined in the text
+        };
+
+    private:
+        static constexpr char magic[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+        static const std::uint32_t version = 4;  // bump when the packed data or the BVH builder changes
+
+        std::unique_ptr<mapped_file> file;
+
+        explicit scene_cache(std::unique_ptr<mapped_file> file) : file(std::move(file)) {}
+
+    public:
+        // 64 bit hash of the bytes, eight at a time, so hashing a large scene takes a fraction
+        // of the time parsing it would
+        static std::uint64_t content_hash(const char* data, size_t size) {
+            std::uint64_t hash = 14695981039346656037ull ^ size;
+            size_t k = 0;
+            for (; k + 8 <= size; k += 8) {
+                std::uint64_t word;
+                std::memcpy(&word, data + k, 8);
+                hash = (hash ^ (word * 0x9e3779b97f4a7c15ull)) * 0xbf58476d1ce4e5b9ull;
+                hash ^= hash >> 29;
+            }
+            for (; k < size; ++k) hash = (hash ^ std::uint8_t(data[k])) * 1099511628211ull;  // FNV-1a for the tail
+            return hash ^ (hash >> 32);
+        }
+
+        static std::string file_name(const std::string& cache_dir, std::uint64_t key) {
+            char name[64];
+            std::snprintf(name, sizeof(name), "scene_%016llx.bin", (unsigned long long)key);
+            return (std::filesystem::path(cache_dir) / name).string();
+        }
+
+        // The cache at path if it exists and was made from a scene file with this key and size
+        static std::shared_ptr<scene_cache> open(const std::string& path, std::uint64_t key, std::uint64_t scene_size) {
+            auto file = std::make_unique<mapped_file>(path);
+            if (!*file || file->size() < sizeof(header)) return nullptr;
+
+            const header* h = reinterpret_cast<const header*>(file->data());
+            if (std::memcmp(h->magic, magic, sizeof(magic)) != 0 || h->version != version ||
+                h->node_size != sizeof(bvh_array_node) || h->prim_size != sizeof(packed_primitive) ||
+                h->key != key || h->scene_size != scene_size) return nullptr;
+
+            // Each count is checked against the file size first so the sum below can't wrap
+            if (h->node_count > file->size() || h->prim_count > file->size() || h->text_size > file->size()) return nullptr;
+            std::uint64_t expected = sizeof(header) + h->node_count * sizeof(bvh_array_node) +
+                                     h->prim_count * sizeof(packed_primitive) + h->text_size;
+            if (file->size() != expected) return nullptr;
+
+            // packed_primitives uses the arrays without bounds checks, a damaged file is a miss
+            auto cache = std::shared_ptr<scene_cache>(new scene_cache(std::move(file)));
+            if (!packed_primitives::valid(cache->nodes(), h->node_count, cache->prims(), h->prim_count, h->material_count))
+                return nullptr;
+            return cache;
+        }
+
+        static bool save(const std::string& path, std::uint64_t key, std::uint64_t scene_size,
+                         const packed_primitives& packed, const std::string& text) {
+            // Written next to the cache and renamed over it: a run that has the old file mapped
+            // keeps its pages, and a crash mid-write never leaves a bad file under a valid name
+            std::error_code error;
+            std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+            std::string temp = path + ".tmp";
+            std::ofstream out(temp, std::ios::binary);
+            if (!out) return false;
+
+            header h = {};
+            std::memcpy(h.magic, magic, sizeof(magic));
+            h.version = version;
+            h.node_size = sizeof(bvh_array_node);
+            h.prim_size = sizeof(packed_primitive);
+            h.key = key;
+            h.scene_size = scene_size;
+            h.node_count = packed.nodes_size();
+            h.prim_count = packed.size();
+            h.text_size = text.size();
+            h.material_count = packed.material_count();
+
+            out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+            out.write(reinterpret_cast<const char*>(packed.node_data()), h.node_count * sizeof(bvh_array_node));
+            out.write(reinterpret_cast<const char*>(packed.prim_data()), h.prim_count * sizeof(packed_primitive));
+            out.write(text.data(), text.size());
+            out.close();
+            if (out) std::filesystem::rename(temp, path, error);
+            if (!out || error) {
+                std::filesystem::remove(temp, error);
+                return false;
+            }
+            return true;
+        }
+
+        const header& info() const { return *reinterpret_cast<const header*>(file->data()); }
+
+        const bvh_array_node* nodes() const {
+            return reinterpret_cast<const bvh_array_node*>(file->data() + sizeof(header));
+        }
+
+        const packed_primitive* prims() const {
+            return reinterpret_cast<const packed_primitive*>(nodes() + info().node_count);
+        }
+
+        std::string text() const {
+            return std::string(reinterpret_cast<const char*>(prims() + info().prim_count), info().text_size);
+        }
+};
+
+static_assert(sizeof(scene_cache::header) == 64, "scene_cache::header is stored as is");
+
+#endif
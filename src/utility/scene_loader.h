@@ -0,0 +1,557 @@
+#ifndef SCENE_LOADER_H
+#define SCENE_LOADER_H
+
+#include "../objects/hittable_list.h"
+#include "../objects/material.h"
+#include "../objects/constant_medium.h"
+#include "../objects/sphere.h"
+#include "../objects/quad.h"
+#include "../objects/triangle.h"
+#include "../objects/bezier.h"
+#include "../objects/transform.h"
+#include "../objects/triangle_mesh.h"
+#include "../objects/packed_primitives.h"
+#include "../objects/instance.h"
+#include "bvh.h"
+#include "mesh_loader.h"
+#include "scene_cache.h"
+
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Loader for .scene files, a line based text format describing everything the built-in scenes
+// in scenes.h build in C++. The file is read front to back in one pass and every object is
+// built as soon as its line is read, so a scene with millions of primitives needs no more
+// memory than the objects themselves. Top level spheres, quads and triangles without modifiers
+// go into one packed_primitives instead of an object each. Every bad line prints an error
+// naming it, and a file with any errors fails to load once all of them are reported.
+//
+// One statement per line, words separated by spaces, '#' starts a comment. A color is three
+// numbers, a point or direction is three numbers.
+//
+//   Camera settings, named like the command line options, which still override them:
+//     aspect_ratio a   width w   aa_samples n   max_depth n   rr_depth n   field_of_view degrees
+//     position x y z   target x y z   vertical_up x y z   defocus_angle degrees
+//     focus_distance d   background r g b   cubemap directory
+//
+//   Textures and materials, named so later lines can use them. Wherever a material takes a
+//   color, the name of a texture can be given instead:
+//     texture name solid r g b
+//     texture name checker scale even_texture odd_texture
+//     texture name image file
+//     texture name noise scale [turbulence]
+//     material name lambertian color
+//     material name metal r g b [fuzz]
+//     material name dielectric index [r g b]
+//     material name emissive color
+//     material name isotropic color
+//
+//   Objects, each followed by optional modifiers:
+//     sphere material x y z radius
+//     moving_sphere material x0 y0 z0 x1 y1 z1 radius
+//     quad material Q u v
+//     triangle material p0 p1 p2
+//     patch material p0 p1 p2 p3
+//     box material a b                       (opposite corners)
+//     bezier material p0 ... p15 [tesselate n]
+//     mesh material file                     (OBJ or PLY)
+//
+//   Groups collect the objects up to the matching end, which takes the modifiers:
+//     group
+//     ...
+//     end [bvh] [modifiers]
+//
+//   Assets collect objects the same way into a BVH that is built once and placed any number of
+//   times by instances, which share it instead of copying it:
+//     asset name
+//     ...
+//     end
+//     instance name [rotate degrees x y z] [translate x y z] [scale x y z] [modifiers]
+//
+//   Modifiers, applied left to right:
+//     rotate degrees x y z    translate x y z    (wrap the object in a transform_o, which is
+//                                                 baked into its geometry once the scene is built)
+//     medium density color    (the object becomes the boundary of a constant_medium)
+//     light                   (the object is sampled as a light, top level only)
+//     bvh                     (groups only, builds a bvh_node over the group)
+//
+//   An instance's rotate, translate and scale, applied left to right, make up one affine
+//   transform instead of wrapping it in transform_o.
+
+namespace scene_loader_detail {
+
+// Cursor over the words of one line
+struct line_reader {
+    const char* s;
+
+    void skip_space() {
+        while (*s == ' ' || *s == '\t' || *s == '\r') ++s;
+        if (*s == '#') while (*s) ++s;
+    }
+
+    bool at_end() {
+        skip_space();
+        return !*s;
+    }
+
+    // Next word, written into out to reuse its storage line after line
+    bool word(std::string& out) {
+        skip_space();
+        const char* start = s;
+        while (*s && *s != ' ' && *s != '\t' && *s != '\r' && *s != '#') ++s;
+        out.assign(start, s);
+        return s != start;
+    }
+
+    bool number(float& out) {
+        skip_space();
+        char* end;
+        out = std::strtof(s, &end);
+        if (end == s) return false;
+        s = end;
+        return true;
+    }
+
+    // Fails on fractions and exponents and on values out of int range instead of truncating them
+    bool integer(int& out) {
+        skip_space();
+        char* end;
+        errno = 0;
+        long value = std::strtol(s, &end, 10);
+        if (end == s || *end == '.' || *end == 'e' || *end == 'E') return false;
+        if (errno == ERANGE || value < INT_MIN || value > INT_MAX) return false;
+        s = end;
+        out = int(value);
+        return true;
+    }
+
+    bool point(vec3& out) {
+        return number(out.x) && number(out.y) && number(out.z);
+    }
+
+    // Whether the next word is a number, for colors that may also be texture names
+    bool number_next() {
+        skip_space();
+        char* end;
+        std::strtof(s, &end);
+        return end != s;
+    }
+};
+
+struct loader {
+    const std::string& path;
+    config& cf;
+    hittable_list& world;
+    hittable_list& lights;
+
+    std::unordered_map<std::string, shared_ptr<texture>> textures;
+    std::unordered_map<std::string, std::uint32_t> material_index;
+    std::vector<shared_ptr<material>> materials;    // in the order they are defined
+    std::vector<hittable_list> groups;
+    std::vector<std::string> group_assets;  // the asset each open group defines, empty for plain groups
+    std::unordered_map<std::string, shared_ptr<hittable>> assets;
+    std::vector<packed_primitive> packed;
+    std::string word;
+    int line_number = 0;
+    int errors = 0;
+    size_t objects = 0;
+
+    loader(const std::string& path, config& cf, hittable_list& world, hittable_list& lights)
+        : path(path), cf(cf), world(world), lights(lights) {}
+
+    void error(const std::string& message) {
+        std::cerr << "ERROR: " << path << ':' << line_number << ": " << message << '\n';
+        ++errors;
+    }
+
+    // Reports the first word left on a line that should have ended
+    void expect_end(line_reader& in) {
+        if (in.word(word)) error("unexpected '" + word + "'");
+    }
+
+    shared_ptr<texture> texture_or_color(line_reader& in) {
+        if (in.number_next()) {
+            vec3 color;
+            if (!in.point(color)) return nullptr;
+            return make_shared<solid_color>(color);
+        }
+        if (!in.word(word)) return nullptr;
+        auto found = textures.find(word);
+        if (found == textures.end()) {
+            error("unknown texture '" + word + "'");
+            return nullptr;
+        }
+        return found->second;
+    }
+
+    bool find_material(line_reader& in, std::uint32_t& index) {
+        if (!in.word(word)) {
+            error("missing material");
+            return false;
+        }
+        auto found = material_index.find(word);
+        if (found == material_index.end()) {
+            error("unknown material '" + word + "'");
+            return false;
+        }
+        index = found->second;
+        return true;
+    }
+
+    void read_texture(line_reader& in) {
+        std::string name, type;
+        if (!in.word(name) || !in.word(type)) return error("texture needs a name and a type");
+
+        shared_ptr<texture> tex;
+        if (type == "solid") {
+            vec3 color;
+            if (in.point(color)) tex = make_shared<solid_color>(color);
+        } else if (type == "checker") {
+            float scale;
+            if (in.number(scale)) {
+                shared_ptr<texture> even = texture_or_color(in);
+                shared_ptr<texture> odd = even ? texture_or_color(in) : nullptr;
+                if (odd) tex = make_shared<checker_texture>(scale, even, odd);
+            }
+        } else if (type == "image") {
+            if (in.word(word)) tex = make_shared<image_texture>(word.c_str());
+        } else if (type == "noise") {
+            float scale = 1.0f;
+            int turbulence = 1;
+            in.number(scale);
+            in.integer(turbulence);
+            tex = make_shared<noise_texture>(scale, turbulence);
+        } else {
+            return error("unknown texture type '" + type + "'");
+        }
+
+        if (!tex) return error("bad " + type + " texture");
+        expect_end(in);
+        textures[name] = tex;
+    }
+
+    void read_material(line_reader& in) {
+        std::string name, type;
+        if (!in.word(name) || !in.word(type)) return error("material needs a name and a type");
+
+        shared_ptr<material> mat;
+        if (type == "lambertian") {
+            if (auto tex = texture_or_color(in)) mat = make_shared<lambertian>(tex);
+        } else if (type == "metal") {
+            vec3 albedo;
+            float fuzz = 0.0f;
+            if (in.point(albedo)) {
+                in.number(fuzz);
+                mat = make_shared<metal>(albedo, fuzz);
+            }
+        } else if (type == "dielectric") {
+            float index;
+            vec3 albedo(1.0f);
+            if (in.number(index)) {
+                if (in.number_next() && !in.point(albedo)) return error("bad dielectric color");
+                mat = make_shared<dielectric>(albedo, index);
+            }
+        } else if (type == "emissive") {
+            if (auto tex = texture_or_color(in)) mat = make_shared<emissive>(tex);
+        } else if (type == "isotropic") {
+            if (auto tex = texture_or_color(in)) mat = make_shared<isotropic>(tex);
+        } else {
+            return error("unknown material type '" + type + "'");
+        }
+
+        if (!mat) return error("bad " + type + " material");
+        expect_end(in);
+        material_index[name] = std::uint32_t(materials.size());
+        materials.push_back(mat);
+    }
+
+    // Reads a sphere, quad or triangle line into prim, false after reporting an error
+    bool read_packable(const std::string& type, line_reader& in, packed_primitive& prim) {
+        if (!find_material(in, prim.material)) return false;
+
+        bool ok = true;
+        int numbers = type == "sphere" ? 4 : 9;
+        for (int k = 0; k < numbers && ok; ++k) ok = in.number(prim.p[k]);
+        if (!ok) {
+            error("bad " + type);
+            return false;
+        }
+        prim.kind = type == "sphere" ? packed_primitive::sphere_kind :
+                    type == "quad" ? packed_primitive::quad_kind : packed_primitive::triangle_kind;
+        return true;
+    }
+
+    // The object of its own a packed primitive becomes when it can't be packed
+    shared_ptr<hittable> unpack(const packed_primitive& prim) {
+        const shared_ptr<material>& mat = materials[prim.material];
+        if (prim.kind == packed_primitive::sphere_kind) return make_shared<sphere>(prim.point(0), prim.p[3], mat);
+        if (prim.kind == packed_primitive::quad_kind) return make_shared<quad>(prim.point(0), prim.point(1), prim.point(2), mat);
+        return make_shared<triangle>(prim.point(0), prim.point(1), prim.point(2), mat);
+    }
+
+    // Reads the object a keyword line describes, nullptr after reporting an error
+    shared_ptr<hittable> read_object(const std::string& type, line_reader& in) {
+        if (type != "moving_sphere" && type != "patch" && type != "box" && type != "bezier" && type != "mesh") {
+            error("unknown statement '" + type + "'");
+            return nullptr;
+        }
+
+        std::uint32_t index;
+        if (!find_material(in, index)) return nullptr;
+        shared_ptr<material> mat = materials[index];
+
+        vec3 p[4];
+        float radius;
+        if (type == "moving_sphere") {
+            if (in.point(p[0]) && in.point(p[1]) && in.number(radius)) return make_shared<sphere>(p[0], p[1], radius, mat);
+        } else if (type == "patch") {
+            if (in.point(p[0]) && in.point(p[1]) && in.point(p[2]) && in.point(p[3]))
+                return make_shared<patch>(p[0], p[1], p[2], p[3], mat);
+        } else if (type == "box") {
+            if (in.point(p[0]) && in.point(p[1])) return box(p[0], p[1], mat);
+        } else if (type == "bezier") {
+            mat4 x, y, z;
+            bool ok = true;
+            for (int k = 0; k < 16 && ok; ++k) ok = in.number(x.e[k]) && in.number(y.e[k]) && in.number(z.e[k]);
+            if (ok) {
+                bezier_patch bp(x, y, z);
+                int tesselation = 0;
+                line_reader peek = in;
+                if (peek.word(word) && word == "tesselate") {
+                    in = peek;
+                    if (!in.integer(tesselation)) ok = false;
+                }
+                if (ok && tesselation > 0) return make_shared<hittable_list>(bp.tesselate(tesselation, mat, "cache"));
+                if (ok) return make_shared<bezier_surface>(bp, mat);
+            }
+        } else if (type == "mesh") {
+            mesh_data mesh;
+            if (in.word(word) && load_mesh(word, mesh)) return make_shared<triangle_mesh>(std::move(mesh), mat);
+            error("could not load mesh");
+            return nullptr;
+        }
+
+        error("bad " + type);
+        return nullptr;
+    }
+
+    // Applies the modifiers after an object or group end, then adds it to the enclosing group,
+    // the lights or the world
+    void place(shared_ptr<hittable> object, line_reader& in) {
+        shared_ptr<transform_o> tf;
+        bool light = false;
+        while (in.word(word)) {
+            if (word == "rotate" || word == "translate") {
+                if (!tf) tf = make_shared<transform_o>(object);
+                float degrees = 0.0f;
+                vec3 v;
+                if ((word == "rotate" && !in.number(degrees)) || !in.point(v)) return error("bad " + word);
+                tf = word == "rotate" ? tf->rotate(degrees, v) : tf->translate(v);
+                object = tf;
+            } else if (word == "medium") {
+                float density;
+                if (!in.number(density)) return error("bad medium");
+                shared_ptr<texture> tex = texture_or_color(in);
+                if (!tex) return error("bad medium");
+                object = make_shared<constant_medium>(object, density, tex);
+                tf = nullptr;
+            } else if (word == "light") {
+                light = true;
+            } else {
+                return error("unknown modifier '" + word + "'");
+            }
+        }
+
+        ++objects;
+        if (!groups.empty()) {
+            if (light) error("light only applies to top level objects");
+            groups.back().add(object);
+        } else if (light) {
+            lights.add(object);
+        } else {
+            world.add(object);
+        }
+    }
+
+    void read_instance(line_reader& in) {
+        if (!in.word(word)) return error("instance needs an asset");
+        auto found = assets.find(word);
+        if (found == assets.end()) return error("unknown asset '" + word + "'");
+
+        // Transforms up to the first other modifier, which place() takes from there
+        affine to_world;
+        line_reader peek = in;
+        while (peek.word(word) && (word == "rotate" || word == "translate" || word == "scale")) {
+            float degrees = 0.0f;
+            vec3 v;
+            if ((word == "rotate" && !peek.number(degrees)) || !peek.point(v)) return error("bad " + word);
+            affine step = word == "rotate" ? affine::rotate(degrees, v) :
+                          word == "translate" ? affine::translate(v) : affine::scale(v);
+            to_world = step * to_world;
+            in = peek;
+        }
+        place(make_shared<instance>(found->second, to_world), in);
+    }
+
+    bool read_setting(const std::string& key, line_reader& in) {
+        bool ok = true;
+        if (key == "aspect_ratio") ok = in.number(cf.aspect_ratio);
+        else if (key == "width") ok = in.integer(cf.image_width);
+        else if (key == "aa_samples") ok = in.integer(cf.aa_samples);
+        else if (key == "max_depth") ok = in.integer(cf.max_depth);
+        else if (key == "rr_depth") ok = in.integer(cf.rr_depth);
+        else if (key == "field_of_view") ok = in.number(cf.vfov);
+        else if (key == "position") ok = in.point(cf.pos);
+        else if (key == "target") ok = in.point(cf.target);
+        else if (key == "vertical_up") ok = in.point(cf.vup);
+        else if (key == "defocus_angle") ok = in.number(cf.defocus_angle);
+        else if (key == "focus_distance") ok = in.number(cf.focus_dist);
+        else if (key == "background") ok = in.point(cf.background);
+        else if (key == "cubemap") ok = in.word(cf.cmap);
+        else return false;
+
+        if (!ok) error("bad " + key);
+        else expect_end(in);
+        return true;
+    }
+
+    void read_line(const std::string& line) {
+        line_reader in{line.c_str()};
+        std::string keyword;
+        if (!in.word(keyword)) return;
+
+        if (keyword == "texture") {
+            read_texture(in);
+        } else if (keyword == "material") {
+            read_material(in);
+        } else if (keyword == "group" || keyword == "asset") {
+            std::string name;
+            if (keyword == "asset" && !in.word(name)) return error("asset needs a name");
+            groups.emplace_back();
+            group_assets.push_back(name);
+        } else if (keyword == "end") {
+            if (groups.empty()) return error("end without group");
+            hittable_list group = std::move(groups.back());
+            std::string asset = std::move(group_assets.back());
+            groups.pop_back();
+            group_assets.pop_back();
+
+            if (!asset.empty()) {
+                if (group.objects.empty()) return error("empty asset");
+                if (!in.at_end()) return error("end of an asset takes no modifiers, its instances do");
+                // A single object like a mesh already has its own BVH
+                assets[asset] = group.objects.size() == 1 ? group.objects[0] : make_shared<bvh_node>(group);
+                return;
+            }
+
+            // bvh comes first among the modifiers since it replaces the list itself
+            line_reader peek = in;
+            bool bvh = peek.word(word) && word == "bvh";
+            if (bvh) in = peek;
+            if (group.objects.empty()) return error("empty group");
+            shared_ptr<hittable> object = bvh ? shared_ptr<hittable>(make_shared<bvh_node>(group))
+                                              : make_shared<hittable_list>(group);
+            --objects;  // counted again as a whole by place()
+            place(object, in);
+        } else if (keyword == "instance") {
+            read_instance(in);
+        } else if (keyword == "sphere" || keyword == "quad" || keyword == "triangle") {
+            packed_primitive prim = {};
+            if (!read_packable(keyword, in, prim)) return;
+            if (groups.empty() && in.at_end()) {
+                packed.push_back(prim);
+                ++objects;
+            } else {
+                place(unpack(prim), in);
+            }
+        } else if (!read_setting(keyword, in)) {
+            if (shared_ptr<hittable> object = read_object(keyword, in)) place(object, in);
+        }
+    }
+};
+
+}
+
+// Adds the objects of the scene file at path to world and lights and applies its camera
+// settings to cf. Returns false if the file couldn't be read or had errors. With a cache_dir
+// the packed primitives and their BVH are saved there, and mapped back in instead of being
+// parsed and built again as long as the file is unchanged.
+inline bool load_scene_file(const std::string& path, config& cf, hittable_list& world, hittable_list& lights,
+                            const std::string& cache_dir = "") {
+    auto start = std::chrono::steady_clock::now();
+    scene_loader_detail::loader load(path, cf, world, lights);
+
+    std::uint64_t key = 0, scene_size = 0;
+    std::string cache_file;
+    shared_ptr<scene_cache> cache;
+    if (!cache_dir.empty()) {
+        mapped_file scene(path);
+        if (scene) {
+            key = scene_cache::content_hash(scene.data(), scene.size());
+            scene_size = scene.size();
+            cache_file = scene_cache::file_name(cache_dir, key);
+            cache = scene_cache::open(cache_file, key, scene_size);
+        }
+    }
+
+    std::string line;
+    std::string kept;   // lines the cache doesn't replace, each after its line number in the scene file
+    int cached_lines = 0;
+    if (cache) {
+        std::istringstream text(cache->text());
+        while (std::getline(text, line)) {
+            size_t start = line.find(' ');
+            load.line_number = std::atoi(line.c_str());
+            load.read_line(start == std::string::npos ? std::string() : line.substr(start + 1));
+            ++cached_lines;
+        }
+    } else {
+        std::ifstream file(path);
+        if (!file) {
+            std::cerr << "ERROR: Could not load scene file '" << path << "'.\n";
+            return false;
+        }
+        while (std::getline(file, line)) {
+            ++load.line_number;
+            size_t packed = load.packed.size();
+            load.read_line(line);
+            if (!cache_file.empty() && load.packed.size() == packed)
+                kept.append(std::to_string(load.line_number)).append(" ").append(line).push_back('\n');
+        }
+    }
+    if (!load.groups.empty()) load.error("group without end");
+
+    if (cache && load.materials.size() != cache->info().material_count) {
+        std::cerr << "ERROR: scene cache " << cache_file << " doesn't match its materials, delete it\n";
+        ++load.errors;
+    } else if (cache) {
+        const scene_cache::header& info = cache->info();
+        world.add(make_shared<packed_primitives>(cache->nodes(), info.node_count, cache->prims(), info.prim_count,
+                                                 load.materials, cache));
+        load.objects += info.prim_count;
+    } else if (!load.packed.empty()) {
+        auto packed = make_shared<packed_primitives>(std::move(load.packed), load.materials);
+        world.add(packed);
+        if (!cache_file.empty() && load.errors == 0 && !scene_cache::save(cache_file, key, scene_size, *packed, kept))
+            std::cerr << "WARNING: could not write scene cache " << cache_file << '\n';
+    }
+
+    // Lights are traced as part of the world too, added last like the built-in scenes do
+    if (!lights.objects.empty()) world.add(lights);
+
+    std::chrono::duration<double, std::milli> parse_time = std::chrono::steady_clock::now() - start;
+    std::cout << "Scene file parse time: " << parse_time.count() << " ms (" << load.objects << " objects from ";
+    if (cache) std::cout << cache_file << " and " << cached_lines << " lines of it)\n";
+    else std::cout << load.line_number << " lines of " << path << ")\n";
+    return load.errors == 0;
+}
+
+#endif
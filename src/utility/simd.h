@@ -0,0 +1,48 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Instruction set plumbing for the SIMD kernels. SSE2 and NEON are part of the x86-64 and
+// AArch64 baselines, so they are used whenever the compiler targets those. AVX2 kernels are
+// compiled with a per-function target attribute and only called after a runtime CPU check,
+// so one binary runs everywhere. Define RAYTRACER_NO_SIMD to force the scalar fallbacks.
+
+#if !defined(RAYTRACER_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64))
+    #define RAYTRACER_SSE 1
+    #include <immintrin.h>
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #endif
+#elif !defined(RAYTRACER_NO_SIMD) && (defined(__aarch64__) || defined(_M_ARM64))
+    #define RAYTRACER_NEON 1
+    #include <arm_neon.h>
+#endif
+
+#if defined(RAYTRACER_SSE) && (defined(__GNUC__) || defined(__clang__))
+    #define RAYTRACER_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+    #define RAYTRACER_TARGET_AVX2
+#endif
+
+namespace simd {
+
+inline bool has_avx2() {
+#if defined(RAYTRACER_SSE) && (defined(__GNUC__) || defined(__clang__))
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    return avx2;
+#elif defined(RAYTRACER_SSE) && defined(_MSC_VER)
+    static const bool avx2 = [] {
+        int info[4];
+        __cpuid(info, 1);
+        bool os_saves_ymm = (info[2] & (1 << 27)) && (_xgetbv(0) & 0x6) == 0x6;
+        __cpuidex(info, 7, 0);
+        return os_saves_ymm && (info[1] & (1 << 5));
+    }();
+    return avx2;
+#else
+    return false;
+#endif
+}
+
+}
+
+#endif
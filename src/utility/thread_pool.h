@@ -0,0 +1,176 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts the outstanding tasks of one batch so a caller can wait on just that batch
+class task_group {
+    private:
+        std::atomic<int> pending{0};
+
+        friend class thread_pool;
+
+    public:
+        task_group() {}
+        task_group(const task_group&) = delete;
+        task_group& operator=(const task_group&) = delete;
+};
+
+// Fixed set of persistent workers, each owning a deque of tasks. Owners push and pop at
+// the back (newest first, good locality for nested work), idle workers steal from the front
+// of someone else's deque (oldest first, usually the biggest piece of remaining work).
+// The thread calling wait() helps run tasks, so a pool of n threads spawns n - 1 workers.
+class thread_pool {
+    private:
+        struct task {
+            std::function<void()> fn;
+            task_group* group;
+        };
+
+        struct work_queue {
+            std::mutex m;
+            std::deque<task> tasks;
+        };
+
+        std::vector<std::thread> workers;
+        std::vector<std::unique_ptr<work_queue>> queues; // one per worker, last one for outside threads
+        std::atomic<int> queued{0};
+        std::atomic<unsigned> next_queue{0};
+        std::atomic<bool> stopping{false};
+        std::mutex sleep_m;
+        std::condition_variable wake;
+
+        static inline thread_local const thread_pool* current = nullptr;
+        static inline thread_local int worker_index = -1;
+
+        int own_queue() const {
+            return current == this ? worker_index : int(queues.size()) - 1;
+        }
+
+        bool pop(int index, task& t) {
+            work_queue& q = *queues[index];
+            std::lock_guard<std::mutex> lock(q.m);
+            if (q.tasks.empty()) return false;
+            t = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            return true;
+        }
+
+        bool steal(int thief, task& t) {
+            int n = int(queues.size());
+            for (int k = 1; k < n; ++k) {
+                work_queue& q = *queues[(thief + k) % n];
+                std::lock_guard<std::mutex> lock(q.m);
+                if (q.tasks.empty()) continue;
+                t = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                return true;
+            }
+            return false;
+        }
+
+        bool try_run(int index) {
+            task t;
+            if (!pop(index, t) && !steal(index, t)) return false;
+            queued.fetch_sub(1, std::memory_order_relaxed);
+            t.fn();
+            t.group->pending.fetch_sub(1, std::memory_order_acq_rel);
+            return true;
+        }
+
+        void worker_loop(int index) {
+            current = this;
+            worker_index = index;
+            while (true) {
+                if (try_run(index)) continue;
+
+                std::unique_lock<std::mutex> lock(sleep_m);
+                wake.wait(lock, [this] { return stopping.load() || queued.load() > 0; });
+                if (stopping.load() && queued.load() == 0) return;
+            }
+        }
+
+    public:
+        // Thread count used by global(), set from --threads before the pool is first touched
+        static inline int configured_threads = 0;
+
+        explicit thread_pool(int threads = 0) {
+            if (threads <= 0) threads = std::max(1, int(std::thread::hardware_concurrency()));
+
+            for (int i = 0; i < threads; ++i)
+                queues.push_back(std::make_unique<work_queue>());
+
+            workers.reserve(threads - 1);
+            for (int i = 0; i < threads - 1; ++i)
+                workers.emplace_back(&thread_pool::worker_loop, this, i);
+        }
+
+        ~thread_pool() {
+            {
+                std::lock_guard<std::mutex> lock(sleep_m);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (std::thread& t : workers) t.join();
+        }
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        static thread_pool& global() {
+            static thread_pool pool(configured_threads);
+            return pool;
+        }
+
+        // Number of threads that execute tasks, including the one waiting on them
+        int size() const { return int(queues.size()); }
+
+        void submit(task_group& group, std::function<void()> fn) {
+            group.pending.fetch_add(1, std::memory_order_relaxed);
+
+            // Work spawned by a worker stays local, work from outside is dealt round-robin
+            int index = (current == this) ? worker_index : int(next_queue++ % queues.size());
+            {
+                work_queue& q = *queues[index];
+                std::lock_guard<std::mutex> lock(q.m);
+                q.tasks.push_back({std::move(fn), &group});
+            }
+            {
+                std::lock_guard<std::mutex> lock(sleep_m);
+                queued.fetch_add(1, std::memory_order_relaxed);
+            }
+            wake.notify_one();
+        }
+
+        // Runs queued tasks on the calling thread until every task of the group has finished
+        void wait(task_group& group) {
+            int index = own_queue();
+            while (group.pending.load(std::memory_order_acquire) > 0) {
+                if (!try_run(index)) std::this_thread::yield();
+            }
+        }
+
+        // Calls f(i) for i in [0, count), at most one task per thread
+        template <typename F>
+        void parallel_for(int count, F f) {
+            task_group group;
+            std::atomic<int> next{0};
+            int tasks = std::min(count, size());
+            for (int t = 0; t < tasks; ++t) {
+                submit(group, [&] {
+                    for (int i = next++; i < count; i = next++) f(i);
+                });
+            }
+            wait(group);
+        }
+};
+
+#endif
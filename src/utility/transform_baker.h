@@ -0,0 +1,77 @@
+#ifndef TRANSFORM_BAKER_H
+#define TRANSFORM_BAKER_H
+
+#include "bvh.h"
+#include "../objects/constant_medium.h"
+#include "../objects/hittable_list.h"
+#include "../objects/transform.h"
+
+#include <unordered_map>
+#include <vector>
+
+// Scene compilation pass run once a scene is built. Each transform_o is replaced by a copy of
+// its object with the transform applied to the geometry, so rays test the moved quads,
+// triangles and spheres directly instead of going through dual quaternions on every test, and
+// the scene BVH sees the primitives instead of one opaque box. Objects that can't be moved
+// exactly keep their transform_o. Instances are left alone, their object is shared.
+//
+// Lists, trees and media around a baked object are rebuilt, anything with no transform inside
+// is kept as it is, and an object reached twice (a light is in both world and lights) is
+// baked once.
+class transform_baker {
+    private:
+        std::unordered_map<const hittable*, shared_ptr<hittable>> done;
+        int baked = 0;
+
+    public:
+        shared_ptr<hittable> bake(const shared_ptr<hittable>& object) {
+            auto found = done.find(object.get());
+            if (found != done.end()) return found->second;
+
+            shared_ptr<hittable> result = object;
+            if (auto tf = std::dynamic_pointer_cast<transform_o>(object)) {
+                if (auto moved = tf->wrapped_object()->transformed(tf->to_world())) {
+                    result = moved;
+                    ++baked;
+                }
+            } else if (auto list = std::dynamic_pointer_cast<hittable_list>(object)) {
+                hittable_list copy = *list;
+                if (bake(copy)) result = make_shared<hittable_list>(copy);
+            } else if (std::dynamic_pointer_cast<bvh_node>(object)) {
+                std::vector<shared_ptr<hittable>> objects;
+                gather_primitives(object, objects);
+                if (bake(objects)) result = make_shared<bvh_node>(objects, 0, int(objects.size()));
+            } else if (auto medium = std::dynamic_pointer_cast<constant_medium>(object)) {
+                shared_ptr<hittable> boundary = bake(medium->boundary_object());
+                if (boundary != medium->boundary_object()) result = medium->with_boundary(boundary);
+            }
+
+            done[object.get()] = result;
+            return result;
+        }
+
+        // Bakes the objects in place, true if any of them changed
+        bool bake(std::vector<shared_ptr<hittable>>& objects) {
+            bool changed = false;
+            for (auto& object : objects) {
+                shared_ptr<hittable> b = bake(object);
+                changed = changed || b != object;
+                object = b;
+            }
+            return changed;
+        }
+
+        bool bake(hittable_list& list) {
+            std::vector<shared_ptr<hittable>> objects = list.objects;
+            if (!bake(objects)) return false;
+            hittable_list rebuilt(int(objects.size()));
+            for (const auto& object : objects) rebuilt.add(object);
+            list = rebuilt;
+            return true;
+        }
+
+        // transform_o wrappers removed so far
+        int transforms_baked() const { return baked; }
+};
+
+#endif